@@ -0,0 +1,60 @@
+#include "main.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+	arena allocator -- memory is handed out from one block by bumping an offset and
+	is given back all at once by resetting the arena. allocations are zeroed and
+	aligned to 16 bytes so they can be used by the vectorized kernels.
+*/
+
+#define ARENA_ALIGN 16
+
+int arena_init( Arena * arena, size_t size )
+{
+	arena->base = (char *) malloc( size );
+	arena->size = arena->base != NULL ? size : 0;
+	arena->used = 0;
+	arena->peak = 0;
+
+	if ( arena->base == NULL )
+	{
+		fprintf( stderr, "Failed to allocate arena of %lu bytes\n", (unsigned long) size );
+		return 1;
+	}
+
+	return 0;
+}
+
+void arena_free( Arena * arena )
+{
+	free( arena->base );
+	arena->base = NULL;
+	arena->size = arena->used = arena->peak = 0;
+}
+
+void * arena_alloc( Arena * arena, size_t size )
+{
+	size_t start = ( arena->used + ARENA_ALIGN - 1 ) & ~(size_t) ( ARENA_ALIGN - 1 );
+
+	if ( start + size > arena->size )
+	{
+		fprintf( stderr, "Arena out of memory: %lu bytes requested, %lu of %lu used\n",
+			(unsigned long) size, (unsigned long) arena->used, (unsigned long) arena->size );
+		return NULL;
+	}
+
+	arena->used = start + size;
+	if ( arena->used > arena->peak )
+		arena->peak = arena->used;
+
+	memset( arena->base + start, 0, size );
+	return arena->base + start;
+}
+
+void arena_reset( Arena * arena )
+{
+	arena->used = 0;
+	arena->peak = 0;
+}
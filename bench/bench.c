@@ -0,0 +1,952 @@
+/*
+	micro-benchmarks for the game systems. the game is built into this file so the
+	benchmarks can reach its internals, and main.c is built with NO_MAIN.
+
+	usage: mario-bench [-o results.csv] [--headless] [benchmark]
+	only the benchmarks whose name contains the given one are run. the window and the
+	audio use SDL's dummy drivers unless others are set, with --headless the drawing
+	benchmarks are skipped.
+
+	results are printed one per line, after a header, as:
+		benchmark,variant,size,iterations,ns_per_iter
+	the variant is the SIMD level for the platform and enemy sweeps and the blits, the
+	number of workers for the world stepping, the map and the number of render threads
+	for the sprite drawing and the map for the rest. the worlds stepped by several
+	workers are checked against the ones stepped by one, the masked blits against SDL's
+	and the banded drawing against one thread's, the exit status is 1 if any of them
+	differ.
+*/
+
+#include "../game.c"
+
+static const int BENCH_WORK			= 20000000;	/* platform updates per measurement */
+static const int BENCH_ROUND			= 60;		/* updates before the platforms are reset */
+static const long BENCH_CALLS			= 2000000;	/* calls per measurement of the per-map benchmarks */
+static const long BENCH_DRAWS			= 2000;		/* full redraws per measurement */
+static const int BENCH_WORLDS			= 512;		/* worlds stepped at once */
+static const int BENCH_WORLD_TICKS		= 1200;		/* ticks every world is stepped per measurement */
+
+/* defined in main.c */
+int init( void );
+void clean_up( void );
+
+static FILE * g_results				= NULL;
+static char * g_filter				= NULL;
+static volatile int g_sink			= 0;	/* keeps the results of the calls from being optimized out */
+
+static int isWanted( const char * benchmark )
+{
+	return g_filter == NULL || strstr( benchmark, g_filter ) != NULL;
+}
+
+static void printResult( const char * benchmark, const char * variant, int size, long iterations, double ms )
+{
+	fprintf( g_results, "%s,%s,%d,%ld,%.1f\n", benchmark, variant, size, iterations, ms * 1000000.0 / iterations );
+	fflush( g_results );
+}
+
+static Arena g_benchArena;
+static Snapshot g_benchSnapshot;				/* of the map being drawn */
+static int g_checkFailed				= 0;	/* a result that has to match another didn't */
+
+static void copyScreen( SDL_Surface * dst, SDL_Surface * src )
+{
+	int y;
+	for ( y = 0; y < src->h; y++ )
+		memcpy( (Uint8 *) dst->pixels + y * dst->pitch, (Uint8 *) src->pixels + y * src->pitch, src->w * 4 );
+}
+
+static int compareScreens( SDL_Surface * a, SDL_Surface * b )
+{
+	int y;
+	for ( y = 0; y < a->h; y++ )
+		if ( memcmp( (Uint8 *) a->pixels + y * a->pitch, (Uint8 *) b->pixels + y * b->pitch, a->w * 4 ) != 0 )
+			return y + 1;
+	return 0;
+}
+
+/************************************************************/
+
+/* fills the map with platforms, placed on empty tiles away from the edges so they never leave the map */
+static void addPlatforms( int count )
+{
+	const int columns = SCREEN_WIDTH / TILE_WIDTH;
+	int i, n = 0;
+
+	/* the map arena is sized for real maps, the benchmark platforms get their own */
+	arena_free( &g_benchArena );
+	if ( arena_init( &g_benchArena, count * ( 6 * sizeof( float ) + sizeof( Direction ) + sizeof( int ) ) + 8 * 16 ) != 0 ||
+	     mpc_init( &g_World.map->mpc, &g_benchArena, count, g_World.map->width ) != 0 )
+		exit( 1 );
+
+	while ( n < count )
+		for ( i = 0; i < columns * g_World.map->height && n < count; i++ )
+		{
+			int x = i % columns, y = i / columns;
+			if ( x < 2 || x >= columns - 2 || y < 2 || y >= g_World.map->height - 2 || map_getTileOf( g_World.map, x, y ) != '.' )
+				continue;
+
+			mpc_addPlatform( &g_World.map->mpc, y * g_World.map->width + x, n % 2 ? UP : RIGHT );
+			n++;
+		}
+}
+
+/* updates the platforms, resetting them every round so they stay where they were placed */
+static void benchPlatforms( int count )
+{
+	float step = 1000.0f / 120;
+	long iterations = BENCH_WORK / count < 100 ? 100 : BENCH_WORK / count;
+	int level, maxLevel = simd_getLevel();
+	MovingPlatformController saved = g_World.map->mpc;
+
+	addPlatforms( count );
+
+	for ( level = SIMD_SCALAR; level <= maxLevel; level++ )
+	{
+		simd_setLevel( level );
+		mpc_reset( &g_World.map->mpc );
+		player_reset( &g_World );
+
+		double start = time_getMillis();
+
+		long i;
+		for ( i = 0; i < iterations; i++ )
+		{
+			if ( i % BENCH_ROUND == 0 )
+				mpc_reset( &g_World.map->mpc );
+
+			game_saveState( &g_World );
+			mpc_update( &g_World, step );
+		}
+
+		printResult( "mpc_update", simd_getLevelName( level ), count, iterations, time_getMillis() - start );
+
+		/* the movement kernel on its own, without the reversal and carry passes */
+		start = time_getMillis();
+		for ( i = 0; i < iterations; i++ )
+		{
+			simd_addScaled( g_World.map->mpc.x, g_World.map->mpc.dx, step, count );
+			simd_addScaled( g_World.map->mpc.y, g_World.map->mpc.dy, step, count );
+		}
+
+		printResult( "mpc_move", simd_getLevelName( level ), count, iterations, time_getMillis() - start );
+	}
+
+	simd_setLevel( maxLevel );
+	g_World.map->mpc = saved;
+}
+
+/* puts the enemies back on their starting tiles, those that were stomped or fell out of the map included */
+static void refillEnemies( EnemyController * ec, const int * positions, int count )
+{
+	int i;
+
+	memset( ec->gone, 0, map_getBitsetSize( g_World.map ) );
+	ec->count = 0;
+	for ( i = 0; i < count; i++ )
+		ec_addEnemy( ec, positions[i] );
+}
+
+/* keeps the player above the map, so the stomp pass only ever rejects the enemies */
+static void liftPlayer( void )
+{
+	player_reset( &g_World );
+	g_World.player.y = -2 * PLAYER_HEIGHT;
+	g_World.player.prevY = g_World.player.y;
+}
+
+/* fills the view with walking enemies and updates them, refilling them every round so they stay where they were placed */
+static void benchEnemies( int count )
+{
+	const int columns = SCREEN_WIDTH / TILE_WIDTH;
+	float step = 1000.0f / 120;
+	long i, iterations = BENCH_WORK / count < 100 ? 100 : BENCH_WORK / count;
+	int level, maxLevel = simd_getLevel(), n = 0;
+	EnemyController * ec = &g_World.map->ec;
+	EnemyController saved = *ec;
+
+	int * positions = (int *) malloc( sizeof( int ) * count );
+	if ( positions == NULL )
+		return;
+
+	/* the map arena is sized for real maps, the benchmark enemies get their own */
+	arena_free( &g_benchArena );
+	if ( arena_init( &g_benchArena, count * ( 6 * sizeof( float ) + sizeof( int ) ) + map_getBitsetSize( g_World.map ) + 8 * 16 ) != 0 ||
+	     ec_init( ec, &g_benchArena, count, g_World.map->width, g_World.map->height ) != 0 )
+		exit( 1 );
+
+	while ( n < count )
+		for ( i = 0; i < columns * g_World.map->height && n < count; i++ )
+		{
+			int x = i % columns, y = i / columns;
+			if ( x < 2 || x >= columns - 2 || y < 2 || y >= g_World.map->height - 2 || map_getTileOf( g_World.map, x, y ) != '.' )
+				continue;
+
+			positions[ n++ ] = y * g_World.map->width + x;
+		}
+
+	for ( level = SIMD_SCALAR; level <= maxLevel; level++ )
+	{
+		simd_setLevel( level );
+		liftPlayer();
+
+		double start = time_getMillis();
+		for ( i = 0; i < iterations; i++ )
+		{
+			if ( i % BENCH_ROUND == 0 )
+				refillEnemies( ec, positions, count );
+
+			game_saveState( &g_World );
+			ec_update( &g_World, step );
+		}
+
+		printResult( "ec_update", simd_getLevelName( level ), count, iterations, time_getMillis() - start );
+	}
+
+	simd_setLevel( maxLevel );
+	player_reset( &g_World );
+	*ec = saved;
+	free( positions );
+}
+
+/* opens every level from text and from its compiled file, which has to have been made by levelc, and reads the first view */
+static void benchMapLoad( void )
+{
+	const long iterations = 2000;
+	char filename[20], compiled[24];
+	Arena arena;
+	int compiledFile;
+
+	if ( arena_init( &arena, MAP_ARENA_SIZE ) != 0 )
+		return;
+
+	for ( compiledFile = 0; compiledFile <= 1; compiledFile++ )
+	{
+		double start = time_getMillis();
+
+		long i;
+		int level;
+		for ( i = 0; i < iterations; i++ )
+			for ( level = 1; level <= 9; level++ )
+			{
+				arena_reset( &arena );
+				sprintf( filename, "levels/level%d", level );
+				sprintf( compiled, "%s.bin", filename );
+
+				Map * map = compiledFile ? map_openCompiled( compiled, &arena ) : map_openText( filename, &arena );
+				if ( map == NULL )
+				{
+					arena_free( &arena );
+					return;
+				}
+
+				map_stream( map, 0 );
+				map_close( map );
+			}
+
+		printResult( "map_load", compiledFile ? "compiled" : "text", 9, iterations, time_getMillis() - start );
+	}
+
+	arena_free( &arena );
+}
+
+/************************************************************/
+
+/*
+	stress maps -- generated maps that fill the area above the ground with one kind of
+	tile, so a system has far more to do than on any shipped level. they are written
+	as level files and loaded like the shipped ones, and are wide enough that only a
+	part of them is resident.
+*/
+
+static const int STRESS_COLUMNS		= 16 * MAP_CHUNK_WIDTH;
+
+typedef struct StressMap
+{
+	const char * name;
+	char tile;				/* tile the map is filled with, platforms alternate between rows */
+	int checkered;			/* only every other tile is filled */
+} StressMap;
+
+static const StressMap STRESS_MAPS[] =
+{
+	{ "stress-coins", 'C', 0 },
+	{ "stress-platforms", 'H', 1 },
+	{ "stress-solid", '#', 1 },
+	{ "stress-enemies", 'G', 0 }
+};
+
+#define NUM_STRESS_MAPS ((int)(sizeof(STRESS_MAPS)/sizeof(STRESS_MAPS[0])))
+
+/* writes a stress map, walled in on a floor with the start on the left and the end on the right */
+static int writeStressMap( const StressMap * stress, char * filename )
+{
+	const int columns = STRESS_COLUMNS, rows = SCREEN_HEIGHT / TILE_HEIGHT;
+	int x, y;
+
+	FILE * fp = fopen( filename, "w" );
+	if ( fp == NULL )
+	{
+		fprintf( stderr, "Failed to open \"%s\" for writing\n", filename );
+		return 1;
+	}
+
+	for ( y = 0; y < rows; y++ )
+	{
+		for ( x = 0; x < columns; x++ )
+		{
+			char tile = '.';
+
+			if ( y == rows - 2 && x == columns - 3 )
+				tile = 'E';
+			else if ( y == rows - 4 && x == 2 )
+				tile = 'S';
+			else if ( y >= rows - 2 || x == 0 || x == columns - 1 )
+				tile = '#';
+			else if ( y >= 2 && y < rows - 4 && x >= 2 && x < columns - 2 && ( !stress->checkered || ( x + y ) % 2 == 0 ) )
+				tile = stress->tile == 'H' && y % 2 ? 'V' : stress->tile;
+
+			fputc( tile, fp );
+		}
+		fputc( '\n', fp );
+	}
+
+	if ( fclose( fp ) != 0 )
+	{
+		fprintf( stderr, "Failed to write \"%s\"\n", filename );
+		return 1;
+	}
+
+	return 0;
+}
+
+/* opens a stress map from a freshly written file, timing the opening and the reading of the first view */
+static Map * loadStressMap( const StressMap * stress, Arena * arena )
+{
+	const long iterations = 2000;
+	char filename[40];
+	Map * map = NULL;
+	long i;
+
+	sprintf( filename, "levels/%s", stress->name );
+	if ( writeStressMap( stress, filename ) != 0 )
+		return NULL;
+
+	if ( ( map = map_openText( filename, arena ) ) != NULL && isWanted( "map_load" ) )
+	{
+		double start = time_getMillis();
+		for ( i = 0; i < iterations && map != NULL; i++ )
+		{
+			map_close( map );
+			arena_reset( arena );
+			if ( ( map = map_openText( filename, arena ) ) != NULL )
+				map_stream( map, 0 );
+		}
+		printResult( "map_load", stress->name, 1, iterations, time_getMillis() - start );
+	}
+
+	/* the open file outlives its name */
+	remove( filename );
+	if ( map != NULL )
+		map_stream( map, 0 );
+	return map;
+}
+
+/************************************************************/
+
+/* probes pixels all over the map and a tile beyond its edges */
+static void benchCollision( const char * name )
+{
+	const int width = SCREEN_WIDTH + 2 * TILE_WIDTH, height = SCREEN_HEIGHT + 2 * TILE_HEIGHT;
+	int hits = 0;
+	long i;
+
+	double start = time_getMillis();
+	for ( i = 0; i < BENCH_CALLS; i++ )
+		hits += map_checkCollision( g_World.map, (int) ( i * 7 % width ) - TILE_WIDTH, (int) ( i * 13 % height ) - TILE_HEIGHT );
+	printResult( "map_checkCollision", name, g_World.map->width * g_World.map->height, BENCH_CALLS, time_getMillis() - start );
+
+	g_sink += hits;
+}
+
+/*
+	redraws the whole view while scrolling a tile a frame, which is what happens on the
+	first frame of a level. the snapshot of the view is taken with every frame, like the
+	game does.
+*/
+static void benchDraw( const char * name )
+{
+	int scroll = g_World.map->width * TILE_WIDTH - SCREEN_WIDTH + TILE_WIDTH;
+	long i;
+
+	double start = time_getMillis();
+	for ( i = 0; i < BENCH_DRAWS; i++ )
+	{
+		int viewX = i * TILE_WIDTH % scroll;
+
+		map_stream( g_World.map, viewX );
+		snapshot_takeMap( &g_benchSnapshot, g_World.map, viewX, 0, viewX, 0 );
+		g_layerX = -1;
+		map_draw( &g_benchSnapshot, viewX, 0 );
+	}
+	printResult( "map_draw", name, g_World.map->width * g_World.map->height, BENCH_DRAWS, time_getMillis() - start );
+
+	map_stream( g_World.map, 0 );
+}
+
+/*
+	redraws the first view in full, the background and the sorted sprites, with each
+	number of render threads up to the number of cores. the picture has to be the
+	same as the one drawn by the main thread alone.
+*/
+static void benchSprites( const char * name )
+{
+	SDL_Surface * screen = SDL_GetVideoSurface(), * expected;
+	int workers, maxWorkers = pool_getCoreCount(), line;
+	char variant[40];
+	long i;
+
+	if ( screen == NULL || ( expected = SDL_DisplayFormat( screen ) ) == NULL )
+		return;
+	if ( snapshot_takeMap( &g_benchSnapshot, g_World.map, 0, 0, 0, 0 ) != 0 )
+	{
+		SDL_FreeSurface( expected );
+		return;
+	}
+
+	for ( workers = 1; ; workers *= 2 )
+	{
+		if ( workers > maxWorkers )
+			workers = maxWorkers;
+		if ( workers > 1 && pool_start( workers ) != 0 )
+			break;
+		render_setBands( workers );
+
+		double start = time_getMillis();
+		for ( i = 0; i < BENCH_DRAWS; i++ )
+		{
+			screen_invalidate();
+			map_draw( &g_benchSnapshot, 0, 0 );
+			mpc_draw( &g_benchSnapshot, 0.5f, 0, 0 );
+			ec_draw( &g_benchSnapshot, 0.5f, 0, 0 );
+			cc_draw( &g_benchSnapshot, 0, 0 );
+			draw_flush();
+		}
+		double ms = time_getMillis() - start;
+
+		render_setBands( 1 );
+		pool_stop();
+
+		sprintf( variant, "%s/%d", name, workers );
+		printResult( "draw_flush", variant, g_benchSnapshot.platformCount + g_benchSnapshot.enemyCount, BENCH_DRAWS, ms );
+
+		if ( workers == 1 )
+			copyScreen( expected, screen );
+		else if ( ( line = compareScreens( expected, screen ) ) != 0 )
+		{
+			fprintf( stderr, "The first view of %s differs on row %d when drawn by %d render threads\n", name, line - 1, workers );
+			g_checkFailed = 1;
+		}
+
+		if ( workers == maxWorkers )
+			break;
+	}
+
+	SDL_FreeSurface( expected );
+}
+
+/* scrolls the view across the map and back a tile at a time, reading the chunks it reaches */
+static void benchStream( const char * name )
+{
+	int scroll = g_World.map->width * TILE_WIDTH - SCREEN_WIDTH + TILE_WIDTH;
+	long i, iterations = BENCH_CALLS / 10;
+
+	double start = time_getMillis();
+	for ( i = 0; i < iterations; i++ )
+	{
+		int viewX = i * TILE_WIDTH % ( 2 * scroll );
+		map_stream( g_World.map, viewX < scroll ? viewX : 2 * scroll - 1 - viewX );
+	}
+	printResult( "map_stream", name, g_World.map->width * g_World.map->height, iterations, time_getMillis() - start );
+
+	map_stream( g_World.map, 0 );
+}
+
+/* moves the player over every tile of the map, putting the coins back after each pass */
+static void benchCoins( const char * name )
+{
+	CoinController * cc = &g_World.map->cc;
+	size_t tilesSize = map_getBitsetSize( g_World.map );
+	int count = cc->count, tiles = g_World.map->width * g_World.map->height;
+	long i;
+
+	unsigned int * coinTiles = (unsigned int *) malloc( tilesSize );
+	if ( coinTiles == NULL )
+		return;
+	memcpy( coinTiles, cc->tiles, tilesSize );
+
+	double start = time_getMillis();
+	for ( i = 0; i < BENCH_CALLS; i++ )
+	{
+		int tile = i % tiles;
+		if ( tile == 0 )
+		{
+			memcpy( cc->tiles, coinTiles, tilesSize );
+			cc->count = count;
+		}
+
+		g_World.player.x = tile % g_World.map->width * TILE_WIDTH;
+		g_World.player.y = tile / g_World.map->width * TILE_HEIGHT;
+		cc_update( &g_World );
+	}
+	printResult( "cc_update", name, count, BENCH_CALLS, time_getMillis() - start );
+
+	memcpy( cc->tiles, coinTiles, tilesSize );
+	cc->count = count;
+	free( coinTiles );
+}
+
+/* runs the map's own platforms, resetting them every round */
+static void benchMapPlatforms( const char * name )
+{
+	float step = 1000.0f / 120;
+	long i, iterations = BENCH_CALLS / 10;
+
+	mpc_reset( &g_World.map->mpc );
+	player_reset( &g_World );
+
+	double start = time_getMillis();
+	for ( i = 0; i < iterations; i++ )
+	{
+		if ( i % BENCH_ROUND == 0 )
+			mpc_reset( &g_World.map->mpc );
+
+		game_saveState( &g_World );
+		mpc_update( &g_World, step );
+	}
+	printResult( "mpc_update", name, g_World.map->mpc.count, iterations, time_getMillis() - start );
+
+	mpc_reset( &g_World.map->mpc );
+}
+
+/* runs the enemies of the map's resident chunks, refilling them every round */
+static void benchMapEnemies( const char * name )
+{
+	float step = 1000.0f / 120;
+	EnemyController * ec = &g_World.map->ec;
+	int count = ec->count;
+	long i, iterations = BENCH_CALLS / 10;
+
+	int * positions = (int *) malloc( sizeof( int ) * ( count + 1 ) );
+	if ( positions == NULL )
+		return;
+	memcpy( positions, ec->startPos, sizeof( int ) * count );
+
+	liftPlayer();
+
+	double start = time_getMillis();
+	for ( i = 0; i < iterations; i++ )
+	{
+		if ( i % BENCH_ROUND == 0 )
+			refillEnemies( ec, positions, count );
+
+		game_saveState( &g_World );
+		ec_update( &g_World, step );
+	}
+	printResult( "ec_update", name, count, iterations, time_getMillis() - start );
+
+	refillEnemies( ec, positions, count );
+	player_reset( &g_World );
+	free( positions );
+}
+
+/* runs right from the start while jumping, starting over every round */
+static void benchPlayer( const char * name )
+{
+	float step = 1000.0f / 120;
+	long i, iterations = BENCH_CALLS / 10;
+
+	double start = time_getMillis();
+	for ( i = 0; i < iterations; i++ )
+	{
+		if ( i % BENCH_ROUND == 0 )
+		{
+			player_reset( &g_World );
+			mpc_reset( &g_World.map->mpc );
+			g_World.player.keyPressed[RIGHT] = 1;
+		}
+
+		/* hold jump for half of each round, pressing it is what starts a jump */
+		g_World.player.keyPressed[UP] = i % BENCH_ROUND < BENCH_ROUND / 2;
+		if ( g_World.player.keyPressed[UP] && g_World.player.jump == CAN_JUMP )
+			g_World.player.jump = JUMPING;
+
+		game_saveState( &g_World );
+		player_update( &g_World, step );
+	}
+	printResult( "player_update", name, g_World.map->width * g_World.map->height, iterations, time_getMillis() - start );
+
+	player_reset( &g_World );
+	mpc_reset( &g_World.map->mpc );
+}
+
+/* runs the per-map benchmarks on a map, which is made the current one while they run */
+static void benchMap( const char * name, Map * map, int canDraw )
+{
+	Map * current = g_World.map;
+	g_World.map = map;
+
+	if ( isWanted( "map_checkCollision" ) ) benchCollision( name );
+	if ( isWanted( "map_draw" ) && canDraw ) benchDraw( name );
+	if ( isWanted( "draw_flush" ) && canDraw ) benchSprites( name );
+	if ( isWanted( "map_stream" ) ) benchStream( name );
+	if ( isWanted( "cc_update" ) ) benchCoins( name );
+	if ( isWanted( "mpc_update" ) ) benchMapPlatforms( name );
+	if ( isWanted( "ec_update" ) ) benchMapEnemies( name );
+	if ( isWanted( "player_update" ) ) benchPlayer( name );
+
+	g_World.map = current;
+}
+
+/* runs the per-map benchmarks on the shipped levels and the stress maps */
+static void benchMaps( int canDraw )
+{
+	char filename[20], loadedFrom[FILENAME_MAX], name[20];
+	Arena arena;
+	int i;
+
+	if ( arena_init( &arena, MAP_ARENA_SIZE ) != 0 )
+		return;
+
+	for ( i = 1; i <= 9 + NUM_STRESS_MAPS; i++ )
+	{
+		Map * map;
+
+		arena_reset( &arena );
+		if ( i <= 9 )
+		{
+			sprintf( filename, "levels/level%d", i );
+			sprintf( name, "level%d", i );
+			map = map_read( filename, &arena, loadedFrom );
+		}
+		else
+		{
+			strcpy( name, STRESS_MAPS[ i - 10 ].name );
+			map = loadStressMap( &STRESS_MAPS[ i - 10 ], &arena );
+		}
+
+		if ( map == NULL )
+			break;
+
+		benchMap( name, map, canDraw );
+
+		map_close( map );
+	}
+
+	snapshot_free( &g_benchSnapshot );
+	arena_free( &arena );
+}
+
+/************************************************************/
+
+/*
+	world stepping -- a crowd of worlds is played by bots, once with each number of
+	workers up to the number of cores. every world runs the same ticks whatever the
+	number of workers, so the time per world tick shows how well the stepping scales.
+*/
+typedef struct Bot
+{
+	int tick;
+	int phase;				/* offsets the jumps so the worlds don't play in lockstep */
+} Bot;
+
+static void pressKey( World * world, SDLKey key, int down )
+{
+	SDL_Event event;
+
+	event.type = down ? SDL_KEYDOWN : SDL_KEYUP;
+	event.key.keysym.sym = key;
+	world_handleEvent( world, &event );
+}
+
+/* runs right, jumping now and then and pressing down to take the exits it stands on */
+static void botInput( World * world, void * data )
+{
+	Bot * bot = (Bot *) data;
+	int t = bot->tick++ + bot->phase;
+
+	if ( t % 240 == 0 )	pressKey( world, SDLK_RIGHT, 1 );
+	if ( t % 90 == 0 )	pressKey( world, SDLK_UP, 1 );
+	if ( t % 90 == 40 )	pressKey( world, SDLK_UP, 0 );
+	if ( t % 120 == 60 )	pressKey( world, SDLK_DOWN, 1 );
+	if ( t % 120 == 70 )	pressKey( world, SDLK_DOWN, 0 );
+}
+
+/* makes the worlds and their bots, returns the number made */
+static int createWorlds( World ** worlds, Bot * bots, int count )
+{
+	int i;
+	for ( i = 0; i < count; i++ )
+	{
+		if ( ( worlds[i] = world_create() ) == NULL )
+			break;
+		bots[i].tick = 0;
+		bots[i].phase = i * 7;
+		world_setInput( worlds[i], botInput, &bots[i] );
+	}
+	return i;
+}
+
+static void destroyWorlds( World ** worlds, int count )
+{
+	int i;
+	for ( i = 0; i < count; i++ )
+		world_destroy( worlds[i] );
+}
+
+static void benchWorlds( void )
+{
+	float step = 1000.0f / 120;
+	int workers, maxWorkers = pool_getCoreCount(), count = 0, i;
+	char variant[20];
+
+	World ** worlds = (World **) malloc( sizeof( World * ) * BENCH_WORLDS );
+	Bot * bots = (Bot *) malloc( sizeof( Bot ) * BENCH_WORLDS );
+	WorldStatus * expected = (WorldStatus *) malloc( sizeof( WorldStatus ) * BENCH_WORLDS );
+	if ( worlds == NULL || bots == NULL || expected == NULL )
+		goto cleanup;
+
+	for ( workers = 1; ; workers *= 2 )
+	{
+		if ( workers > maxWorkers )
+			workers = maxWorkers;
+
+		if ( ( count = createWorlds( worlds, bots, BENCH_WORLDS ) ) < BENCH_WORLDS || pool_start( workers ) != 0 )
+			break;
+
+		double start = time_getMillis();
+		world_stepAll( worlds, count, step, BENCH_WORLD_TICKS );
+		double ms = time_getMillis() - start;
+		pool_stop();
+
+		sprintf( variant, "%d", workers );
+		printResult( "world_step", variant, count, (long) count * BENCH_WORLD_TICKS, ms );
+
+		/* the worlds have to end up the same however many workers stepped them */
+		for ( i = 0; i < count; i++ )
+		{
+			WorldStatus status;
+			world_getStatus( worlds[i], &status );
+			if ( workers == 1 )
+				expected[i] = status;
+			else if ( memcmp( &status, &expected[i], sizeof( status ) ) != 0 )
+			{
+				fprintf( stderr, "World %d differs when stepped by %d workers\n", i, workers );
+				g_checkFailed = 1;
+				break;
+			}
+		}
+
+		destroyWorlds( worlds, count );
+		count = 0;
+
+		if ( workers == maxWorkers )
+			break;
+	}
+
+	cleanup:
+
+		destroyWorlds( worlds, count );
+		free( worlds );
+		free( bots );
+		free( expected );
+}
+
+/************************************************************/
+
+/*
+	masked blits -- the images with opacity masks are drawn by drawImage at every SIMD
+	level and by SDL onto copies of the same screen, at every offset against the edges
+	of the screen, and the screens have to come out the same. then both ways are timed
+	on blits that land anywhere on the screen.
+*/
+typedef struct BlitCase
+{
+	SDL_Surface ** image;
+	SDL_Rect rect;			/* part of the image that is drawn */
+} BlitCase;
+
+/* draws a part of an image at each offset against the edges, overlapping each other */
+static void drawAgainstEdges( SDL_Surface * image, SDL_Rect * part, SDL_Surface * reference )
+{
+	int x, y;
+	for ( y = -part->h - 1; y <= SCREEN_HEIGHT + 1; y++ )
+	{
+		if ( y == 2 ) y = SCREEN_HEIGHT - part->h - 2;
+		for ( x = -part->w - 1; x <= SCREEN_WIDTH + 1; x++ )
+		{
+			if ( x == 2 ) x = SCREEN_WIDTH - part->w - 2;
+			if ( reference == NULL )
+				drawImage( image, part, x, y );
+			else
+			{
+				SDL_Rect dst = rect( x, y, 0, 0 );
+				SDL_BlitSurface( image, part, reference, &dst );
+			}
+		}
+	}
+}
+
+static int checkBlits( SDL_Surface * screen, SDL_Surface * reference, BlitCase * blit )
+{
+	int level, maxLevel = simd_getLevel(), x, y;
+
+	for ( level = SIMD_SCALAR; level <= maxLevel; level++ )
+	{
+		simd_setLevel( level );
+
+		/* noise shows the pixels that are wrongly drawn or left alone */
+		for ( y = 0; y < screen->h; y++ )
+			for ( x = 0; x < screen->w; x++ )
+				( (Uint32 *) ( (Uint8 *) screen->pixels + y * screen->pitch ) )[x] = ( x * 2654435761u ^ y * 40503u ) & 0xFFFFFF;
+		copyScreen( reference, screen );
+
+		drawAgainstEdges( *blit->image, &blit->rect, NULL );
+		drawAgainstEdges( *blit->image, &blit->rect, reference );
+
+		if ( ( y = compareScreens( screen, reference ) ) != 0 )
+		{
+			fprintf( stderr, "Masked blit of a %dx%d image differs from SDL's at the %s level, on row %d\n",
+				blit->rect.w, blit->rect.h, simd_getLevelName( level ), y - 1 );
+			simd_setLevel( maxLevel );
+			return 1;
+		}
+	}
+
+	simd_setLevel( maxLevel );
+	return 0;
+}
+
+static void timeBlits( BlitCase * blit, const char * variant )
+{
+	const int width = SCREEN_WIDTH - blit->rect.w, height = SCREEN_HEIGHT - blit->rect.h;
+	long i;
+
+	double start = time_getMillis();
+	for ( i = 0; i < BENCH_CALLS; i++ )
+		drawImage( *blit->image, &blit->rect, (int) ( i * 7 % width ), (int) ( i * 13 % height ) );
+	printResult( "drawImage", variant, blit->rect.w * blit->rect.h, BENCH_CALLS, time_getMillis() - start );
+}
+
+static void benchBlits( void )
+{
+	BlitCase blits[4];
+	SDL_Surface * screen = SDL_GetVideoSurface(), * reference;
+	int i, level, maxLevel = simd_getLevel();
+
+	blits[0].image = &g_imgTileset; blits[0].rect = map_getTileRect( 7, 1 );			/* coin */
+	blits[1].image = &g_imgTileset; blits[1].rect = map_getTileRect( 3, 10 );			/* edge of the ground */
+	blits[2].image = &g_imgPlayer;  blits[2].rect = anim_getRect( PLAYER_MOVE_RIGHT, 1 );
+	blits[3].image = &g_imgEnemy;   blits[3].rect = rect( 0, 0, ENEMY_WIDTH, ENEMY_HEIGHT );
+
+	if ( screen == NULL || ( reference = SDL_DisplayFormat( screen ) ) == NULL )
+		return;
+
+	for ( i = 0; i < 4; i++ )
+		g_checkFailed |= checkBlits( screen, reference, &blits[i] );
+
+	for ( i = 0; i < 4; i++ )
+	{
+		for ( level = SIMD_SCALAR; level <= maxLevel; level++ )
+		{
+			simd_setLevel( level );
+			timeBlits( &blits[i], simd_getLevelName( level ) );
+		}
+		simd_setLevel( maxLevel );
+
+		/* without the masks every blit goes through SDL */
+		blit_freeMasks();
+		timeBlits( &blits[i], "sdl" );
+		blit_addMask( g_imgTileset );
+		blit_addMask( g_imgPlayer );
+		blit_addMask( g_imgEnemy );
+	}
+
+	SDL_FreeSurface( reference );
+}
+
+/************************************************************/
+
+int main( int argc, char ** argv )
+{
+	static const int PLATFORM_COUNTS[] = { 10, 100, 1000, 10000, 100000 };
+	static const int ENEMY_COUNTS[] = { 100, 1000, 4000, 16000, 100000 };
+	char * output = NULL;
+	int i;
+
+	for ( i = 1; i < argc; i++ )
+	{
+		if ( strcmp( argv[i], "-o" ) == 0 && i + 1 < argc )
+			output = argv[ ++i ];
+		else if ( strcmp( argv[i], "--headless" ) == 0 )
+			g_Headless = 1;
+		else if ( argv[i][0] != '-' && g_filter == NULL )
+			g_filter = argv[i];
+		else
+		{
+			fprintf( stderr, "Usage: %s [-o results.csv] [--headless] [benchmark]\n", argv[0] );
+			return 1;
+		}
+	}
+
+	g_results = stdout;
+	if ( output != NULL && ( g_results = fopen( output, "w" ) ) == NULL )
+	{
+		fprintf( stderr, "Failed to open \"%s\" for writing\n", output );
+		return 1;
+	}
+
+	/* the drawing benchmarks need a screen, but no window or sound has to be seen or heard */
+	if ( getenv( "SDL_VIDEODRIVER" ) == NULL ) SDL_putenv( (char *) "SDL_VIDEODRIVER=dummy" );
+	if ( getenv( "SDL_AUDIODRIVER" ) == NULL ) SDL_putenv( (char *) "SDL_AUDIODRIVER=dummy" );
+
+	if ( init() != 0 )
+		return 1;
+
+	/* sounds aren't part of what is measured */
+	int canDraw = !g_Headless;
+	g_Headless = 1;
+
+	fprintf( g_results, "benchmark,variant,size,iterations,ns_per_iter\n" );
+
+	if ( isWanted( "mpc_update" ) || isWanted( "mpc_move" ) )
+		for ( i = 0; i < sizeof( PLATFORM_COUNTS ) / sizeof( PLATFORM_COUNTS[0] ); i++ )
+			benchPlatforms( PLATFORM_COUNTS[i] );
+
+	if ( isWanted( "ec_update" ) )
+		for ( i = 0; i < sizeof( ENEMY_COUNTS ) / sizeof( ENEMY_COUNTS[0] ); i++ )
+			benchEnemies( ENEMY_COUNTS[i] );
+
+	if ( isWanted( "map_load" ) )
+		benchMapLoad();
+
+	benchMaps( canDraw );
+
+	if ( isWanted( "world_step" ) )
+		benchWorlds();
+
+	if ( isWanted( "drawImage" ) && canDraw )
+		benchBlits();
+
+	g_Headless = !canDraw;
+	clean_up();
+	arena_free( &g_benchArena );
+
+	if ( g_results != stdout && fclose( g_results ) != 0 )
+	{
+		fprintf( stderr, "Failed to write \"%s\"\n", output );
+		return 1;
+	}
+
+	return g_checkFailed;
+}
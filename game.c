@@ -1,20 +1,32 @@
+#define _POSIX_C_SOURCE 200112L
+#define _DEFAULT_SOURCE		/* madvise, see map_releaseChunk */
+
 #include "main.h"
 
 #include <ctype.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 static const int TILE_WIDTH			= 16;
 static const int TILE_HEIGHT			= 16;
 
-#define NUM_TILES ((SCREEN_WIDTH/TILE_WIDTH)*(SCREEN_HEIGHT/TILE_HEIGHT))
-
 static const int PLAYER_WIDTH 		= 16;
 static const int PLAYER_HEIGHT		= 28;
 
 #define HALF_PLAYER_WIDTH 			(PLAYER_WIDTH/2)
 #define HALF_PLAYER_HEIGHT 			(PLAYER_HEIGHT/2)
 
-/* note: move speeds are in pixel-per-second */
+static const int ENEMY_WIDTH			= 15;
+static const int ENEMY_HEIGHT			= 18;
+
+/* note: move speeds are in pixel-per-second, accelerations are per reference frame */
+
+static const float REFERENCE_FRAME_TIME	= 1000.0f / 60;
 
 static const int PLAYER_MOVE_SPEED 	= 16;
 static const int PLAYER_JUMP_SPEED		= 32;
@@ -25,11 +37,21 @@ static const int PLAYER_MAX_MOVE_SPEED  = 288;
 
 static const int PLATFORM_MOVE_SPEED 	= 48;
 
+static const int ENEMY_MOVE_SPEED		= 32;
+static const int ENEMY_FALL_SPEED		= 32;
+static const int ENEMY_MAX_FALL_SPEED	= 320;
+static const int ENEMY_STOMP_SPEED		= 192;	/* speed the player bounces off a stomped enemy at */
+static const int ENEMY_STOMP_SCORE		= 100;
+
 static const int COINS_PER_LIFE		= 25;
 static const int INIT_PLAYER_LIVES		= 2;
 static const int MAX_PLAYER_LIVES		= 5;
 static const int PLAYER_FRAME_TIME		= 50;
 
+/* pauses follow the length of their music, but are timed so they don't depend on playback */
+static const int DEATH_TIME			= 2750;
+static const int GAME_OVER_TIME		= 3800;
+
 /* resources */
 
 static SDL_Surface * g_imgTileset 		= NULL;
@@ -42,10 +64,8 @@ static SDL_Surface * g_imgGameOver		= NULL;
 static TTF_Font * g_fontSmall			= NULL;
 static TTF_Font * g_fontLarge			= NULL;
 
-static SDL_Surface * g_textLives		= NULL;
-static SDL_Surface * g_textScore		= NULL;
-static SDL_Surface * g_textCoins		= NULL;
-static SDL_Surface * g_textLevel		= NULL;
+static GlyphAtlas g_atlasSmall;			/* HUD text */
+static GlyphAtlas g_atlasLarge;			/* level titles */
 static SDL_Surface * g_textPressAnyKey	= NULL;
 
 static Mix_Music * g_musBGM			= NULL;
@@ -56,14 +76,6 @@ static Mix_Chunk * g_sfxJump			= NULL;
 static Mix_Chunk * g_sfxStomp			= NULL;
 static Mix_Chunk * g_sfx1Up			= NULL;
 
-/* global variables */
-
-static int g_curLevel				= 1;
-static int g_displayLevelText			= 1;
-static Timer g_utilTimer;
-
-int reset( void );
-
 /************************************************************/
 
 typedef enum Direction
@@ -88,104 +100,127 @@ Direction dir_getOpposite( Direction d )
 
 /************************************************************/
 
+/* 
+	tile bitsets are laid out strip by strip: a word holds one row of a 32-column strip 
+	and the rows of a strip follow each other, so the word of a tile is found with a 
+	shift and a vertical run of tiles stays within consecutive words
+*/
+
+#define BITSET_WORD_BITS 32
+
+unsigned int * bitset_create( Arena * arena, int width, int height )
+{
+	return (unsigned int *) arena_alloc( arena, ( width + BITSET_WORD_BITS - 1 ) / BITSET_WORD_BITS * height * sizeof( unsigned int ) );
+}
+
+unsigned int * bitset_getWord( unsigned int * bits, int height, int x, int y )
+{
+	return &bits[ ( x / BITSET_WORD_BITS ) * height + y ];
+}
+
+int bitset_test( unsigned int * bits, int height, int x, int y )
+{
+	return ( *bitset_getWord( bits, height, x, y ) >> ( x % BITSET_WORD_BITS ) ) & 1;
+}
+
+void bitset_set( unsigned int * bits, int height, int x, int y )
+{
+	*bitset_getWord( bits, height, x, y ) |= 1u << ( x % BITSET_WORD_BITS );
+}
+
+void bitset_clear( unsigned int * bits, int height, int x, int y )
+{
+	*bitset_getWord( bits, height, x, y ) &= ~( 1u << ( x % BITSET_WORD_BITS ) );
+}
+
+/************************************************************/
+
 typedef struct CoinController
 {
-	int count;		/* number of coins */
-	int size;			/* size of array */
-	int * array;		/* coin pos array */
+	int count;		/* number of coins left */
+	int height;		/* height of the map in tiles */
+	unsigned int * tiles;	/* bitset of the tiles that still have a coin */
 } CoinController;
 
-void cc_init( CoinController * cc )
+int cc_init( CoinController * cc, Arena * arena, int width, int height )
 {
 	cc->count = 0;
-	cc->size 	= 10; /* arbitrary number */
-	cc->array = (int *) calloc( cc->size, sizeof( int ) );
+	cc->height = height;
+	cc->tiles = bitset_create( arena, width, height );
 	
-	int i;
-	for ( i = 0; i < cc->size; i++ )
-		cc->array[i] = -1;
+	return cc->tiles == NULL;
 }
 
-void cc_cleanup( CoinController * cc )
-{	
-	free( cc->array );
+void cc_addCoin( CoinController * cc, int x, int y )
+{
+	if ( bitset_test( cc->tiles, cc->height, x, y ) ) return;
+	
+	bitset_set( cc->tiles, cc->height, x, y );
+	cc->count++;
 }
 
-void cc_addCoin( CoinController * cc, int index )
+void cc_removeCoin( CoinController * cc, int x, int y )
 {
-	/* check for available space */
-	if ( cc->count == cc->size )
-	{
-		/* realloc the array */
-		cc->size *= 2;
-		cc->array = (int*) realloc( cc->array, sizeof( int ) * cc->size );
-		
-		int i;
-		for ( i = cc->count; i < cc->size; i++ )
-			cc->array[i] = -1;
-	}
-	
-	cc->array[ cc->count++ ] = index;
+	bitset_clear( cc->tiles, cc->height, x, y );
+	cc->count--;
 }
 
 /************************************************************/
 
-typedef struct MovingPlatform
-{
-	int startPos;			/* starting position */
-	float x, y;			/* position of platform */
-	Direction dir;			/* direction to move in */
-} MovingPlatform;
-
+/*
+	moving platforms are stored as parallel arrays so the movement of every platform
+	can be done in one pass by a vectorized kernel. dx and dy are the unit direction
+	of each platform and are kept in step with dir.
+*/
 typedef struct MovingPlatformController
 {
 	int count;			/* number of active platforms */
-	int size;				/* size of platform array */
-	MovingPlatform ** array;	/* moving platform array */
+	int size;				/* size of the platform arrays */
+	int width;			/* width of the map in tiles, to place the platforms */
+	float * x, * y;		/* position of each platform */
+	float * prevX, * prevY;	/* position before the last update */
+	float * dx, * dy;		/* direction to move in as a unit vector */
+	Direction * dir;		/* direction to move in */
+	int * startPos;		/* starting position */
 } MovingPlatformController;
 
-void mpc_init( MovingPlatformController * mpc )
+void mpc_setDirection( MovingPlatformController * mpc, int i, Direction d )
 {
-	mpc->count = 0;
-	mpc->size = 10; /* arbitrary number */
-	mpc->array = (MovingPlatform **) realloc( NULL, sizeof( MovingPlatform * ) * mpc->size );
-	
-	int i;
-	for ( i = 0; i < mpc->size; i++ )
-		mpc->array[i] = NULL;
+	mpc->dir[i] = d;
+	mpc->dx[i] = d == LEFT ? -1.0f : d == RIGHT ? 1.0f : 0.0f;
+	mpc->dy[i] = d == UP ? -1.0f : d == DOWN ? 1.0f : 0.0f;
 }
 
-void mpc_cleanup( MovingPlatformController * mpc )
+int mpc_init( MovingPlatformController * mpc, Arena * arena, int size, int width )
 {
-	int i;
-	for ( i = 0; i < mpc->size; i++ )
-		free( mpc->array[i] );
-	free( mpc->array );
+	mpc->count = 0;
+	mpc->size = size;
+	mpc->width = width;
+	mpc->x 		= (float *) arena_alloc( arena, sizeof( float ) * size );
+	mpc->y 		= (float *) arena_alloc( arena, sizeof( float ) * size );
+	mpc->prevX 	= (float *) arena_alloc( arena, sizeof( float ) * size );
+	mpc->prevY 	= (float *) arena_alloc( arena, sizeof( float ) * size );
+	mpc->dx 		= (float *) arena_alloc( arena, sizeof( float ) * size );
+	mpc->dy 		= (float *) arena_alloc( arena, sizeof( float ) * size );
+	mpc->dir 		= (Direction *) arena_alloc( arena, sizeof( Direction ) * size );
+	mpc->startPos 	= (int *) arena_alloc( arena, sizeof( int ) * size );
+	
+	return mpc->startPos == NULL; /* the last allocation fails if any of them did */
 }
 
 void mpc_addPlatform( MovingPlatformController * mpc, int i, Direction d )
 {
-	/* check for available space */
-	if ( mpc->count == mpc->size )
-	{
-		/* realloc the array */
-		mpc->size *= 2;
-		mpc->array = (MovingPlatform **) realloc( mpc->array, sizeof( MovingPlatform * ) * mpc->size );
-		
-		int i;
-		for ( i = mpc->count; i < mpc->size; i++ )
-			mpc->array[i] = NULL;
-	}
-	
-	/* create a new platform */
-	MovingPlatform * mp = (MovingPlatform *) malloc( sizeof( MovingPlatform ) );
-	mp->x 	= i % ( SCREEN_WIDTH / TILE_WIDTH ) * TILE_WIDTH;
-	mp->y 	= i / ( SCREEN_WIDTH / TILE_WIDTH ) * TILE_HEIGHT;
-	mp->dir 	= d;
-	mp->startPos = i;
+	/* the arrays are sized when the map is loaded */
+	if ( mpc->count == mpc->size ) return;
 	
-	/* add the platform the array */
-	mpc->array[ mpc->count++ ] = mp;
+	/* add the platform to the arrays */
+	int n = mpc->count++;
+	mpc->x[n] 	= i % mpc->width * TILE_WIDTH;
+	mpc->y[n] 	= i / mpc->width * TILE_HEIGHT;
+	mpc->prevX[n]	= mpc->x[n];
+	mpc->prevY[n]	= mpc->y[n];
+	mpc->startPos[n] = i;
+	mpc_setDirection( mpc, n, d );
 }
 
 void mpc_reset( MovingPlatformController * mpc )
@@ -193,26 +228,137 @@ void mpc_reset( MovingPlatformController * mpc )
 	int i;
 	for ( i = 0; i < mpc->count; i++ )
 	{
-		MovingPlatform * mp = mpc->array[i];
-		if ( mp == NULL ) continue;
+		mpc->x[i] = mpc->startPos[i] % mpc->width * TILE_WIDTH;
+		mpc->y[i] = mpc->startPos[i] / mpc->width * TILE_HEIGHT;
+		mpc->prevX[i] = mpc->x[i];
+		mpc->prevY[i] = mpc->y[i];
 		
-		mp->x = mp->startPos % ( SCREEN_WIDTH / TILE_WIDTH ) * TILE_WIDTH;
-		mp->y = mp->startPos / ( SCREEN_WIDTH / TILE_WIDTH ) * TILE_HEIGHT;
-		
-		switch ( mp->dir )
+		switch ( mpc->dir[i] )
 		{
 			case LEFT:
 			case RIGHT:
-				mp->dir = RIGHT;
+				mpc_setDirection( mpc, i, RIGHT );
 			break;
 			case UP:
 			case DOWN:
-				mp->dir = UP;
+				mpc_setDirection( mpc, i, UP );
 			break;
 		}
 	}
 }
 
+/* removes the platforms that start in a range of columns, the others stay in order */
+void mpc_removeColumns( MovingPlatformController * mpc, int first, int count )
+{
+	int i, n = 0;
+	for ( i = 0; i < mpc->count; i++ )
+	{
+		int column = mpc->startPos[i] % mpc->width;
+		if ( column >= first && column < first + count )
+			continue;
+		
+		mpc->x[n] = mpc->x[i];
+		mpc->y[n] = mpc->y[i];
+		mpc->prevX[n] = mpc->prevX[i];
+		mpc->prevY[n] = mpc->prevY[i];
+		mpc->dx[n] = mpc->dx[i];
+		mpc->dy[n] = mpc->dy[i];
+		mpc->dir[n] = mpc->dir[i];
+		mpc->startPos[n] = mpc->startPos[i];
+		n++;
+	}
+	mpc->count = n;
+}
+
+/************************************************************/
+
+/*
+	enemies are walkers kept as parallel arrays like the platforms, so each pass of
+	ec_update goes over every enemy in turn. like platforms they belong to the chunk
+	they start in, but an enemy that is stomped or falls out of the map is gone for
+	the rest of the level, so the starting tiles of those are kept in a bitset.
+*/
+typedef struct EnemyController
+{
+	int count;			/* number of active enemies */
+	int size;				/* size of the enemy arrays */
+	int width, height;		/* size of the map in tiles, to place the enemies */
+	float * x, * y;		/* position of each enemy */
+	float * prevX, * prevY;	/* position before the last update */
+	float * dx;			/* direction to walk in, -1 or 1 */
+	float * yVel;			/* falling speed */
+	int * startPos;		/* starting position */
+	unsigned int * gone;	/* starting tiles of the enemies that are gone */
+} EnemyController;
+
+int ec_init( EnemyController * ec, Arena * arena, int size, int width, int height )
+{
+	ec->count = 0;
+	ec->size = size;
+	ec->width = width;
+	ec->height = height;
+	ec->x 		= (float *) arena_alloc( arena, sizeof( float ) * size );
+	ec->y 		= (float *) arena_alloc( arena, sizeof( float ) * size );
+	ec->prevX 	= (float *) arena_alloc( arena, sizeof( float ) * size );
+	ec->prevY 	= (float *) arena_alloc( arena, sizeof( float ) * size );
+	ec->dx 		= (float *) arena_alloc( arena, sizeof( float ) * size );
+	ec->yVel 		= (float *) arena_alloc( arena, sizeof( float ) * size );
+	ec->startPos 	= (int *) arena_alloc( arena, sizeof( int ) * size );
+	ec->gone 		= bitset_create( arena, width, height );
+
+	return ec->gone == NULL; /* the last allocation fails if any of them did */
+}
+
+/* puts an enemy at its starting tile, walking left */
+static void ec_place( EnemyController * ec, int n )
+{
+	ec->x[n] = ec->startPos[n] % ec->width * TILE_WIDTH;
+	ec->y[n] = ec->startPos[n] / ec->width * TILE_HEIGHT + TILE_HEIGHT - ENEMY_HEIGHT;
+	ec->prevX[n] = ec->x[n];
+	ec->prevY[n] = ec->y[n];
+	ec->dx[n] = -1.0f;
+	ec->yVel[n] = 0.0f;
+}
+
+void ec_addEnemy( EnemyController * ec, int i )
+{
+	/* the arrays are sized when the map is loaded */
+	if ( ec->count == ec->size || bitset_test( ec->gone, ec->height, i % ec->width, i / ec->width ) ) return;
+
+	ec->startPos[ ec->count ] = i;
+	ec_place( ec, ec->count++ );
+}
+
+void ec_reset( EnemyController * ec )
+{
+	int i;
+	for ( i = 0; i < ec->count; i++ )
+		ec_place( ec, i );
+}
+
+/* removes the enemies that are gone, or that start in a range of columns, the others stay in order */
+void ec_removeEnemies( EnemyController * ec, int first, int count )
+{
+	int i, n = 0;
+	for ( i = 0; i < ec->count; i++ )
+	{
+		int column = ec->startPos[i] % ec->width;
+		if ( ( column >= first && column < first + count ) ||
+		     bitset_test( ec->gone, ec->height, column, ec->startPos[i] / ec->width ) )
+			continue;
+
+		ec->x[n] = ec->x[i];
+		ec->y[n] = ec->y[i];
+		ec->prevX[n] = ec->prevX[i];
+		ec->prevY[n] = ec->prevY[i];
+		ec->dx[n] = ec->dx[i];
+		ec->yVel[n] = ec->yVel[i];
+		ec->startPos[n] = ec->startPos[i];
+		n++;
+	}
+	ec->count = n;
+}
+
 /************************************************************/
 
 typedef enum JumpState
@@ -222,9 +368,10 @@ typedef enum JumpState
 	JUMPED
 } JumpState;
 
-static struct Player
+typedef struct Player
 {
 	float x, y;			/* position of player */
+	float prevX, prevY;		/* position before the last update */
 	float xVel, yVel;		/* velocity of player */
 	Direction lastDir;		/* last direction facing */
 	JumpState jump;		/* jump state to determine if can jump */
@@ -238,142 +385,1146 @@ static struct Player
 	int onPlatform;          /* boolean if player is on platform */
 	Timer frameTimer;		/* timer to update frame */
 	Sprite sprite;			/* sprite information */
-} g_Player;
+} Player;
 
 /************************************************************/
 
+/*
+	everything a map owns, apart from its file, is allocated from one arena. there are
+	two arenas so the next map can be loaded while the current one is still in use,
+	and a map is freed by resetting its arena. the static layer and the cached chunks
+	aren't the map's, they are drawn from snapshots of it.
+*/
+static const size_t MAP_ARENA_SIZE	= 512 * 1024; /* fits resident chunks full of platforms and enemies */
+
+/*
+	levels are streamed in chunks of MAP_CHUNK_WIDTH columns, one strip of the bitsets.
+	only the chunks around the camera are resident, the others are read from the level
+	file when the camera reaches them and take over the slot of a chunk that was left
+	behind, so a level takes the same memory however long it is. the coins have to be
+	remembered when a chunk is read again, so they are kept for the whole level at a
+	bit per tile. platforms and enemies belong to the chunk they start in and are
+	spawned with it.
+*/
+#define MAP_CHUNK_WIDTH BITSET_WORD_BITS
+#define MAP_CHUNK_SLOTS 8	/* enough for the view and a chunk either side of it */
+
+typedef struct Chunk
+{
+	int index;						/* chunk held by the slot, -1 when empty */
+	char * tiles;					/* MAP_CHUNK_WIDTH tiles per row, '.' past the end of the map */
+	unsigned int * solid;			/* solid tiles, one word per row */
+} Chunk;
+
 typedef struct Map
 {
-	char * data;					/* map data */
-	int startPos;					/* starting position */
-	CoinController cc;				/* coins */
-	MovingPlatformController mpc;		/* moving platforms */
+	Arena * arena;					/* memory of the map */
+	int width, height;				/* size in tiles */
+	int startPos;					/* starting position, y * width + x */
+	int endPos;					/* end position */
+	FILE * file;					/* text level the chunks are read from */
+	long * rows;					/* offset of the first tile of each row of a text level */
+	int * rowLengths;				/* tiles in each row of a text level, -1 if there are spaces between them */
+	char * level;					/* mapped compiled level the chunks are in, NULL for a text one */
+	size_t levelSize;				/* size of the mapping */
+	long chunkOffset;				/* offset of the first chunk of a compiled level */
+	long chunkSize;				/* size of each chunk of a compiled level */
+	int chunkCount;				/* number of chunks in the level */
+	Chunk chunks[MAP_CHUNK_SLOTS];	/* resident chunks, chunk i is held by slot i % MAP_CHUNK_SLOTS */
+	int serial;					/* tells the maps apart, every map read gets a new one */
+	CoinController cc;				/* coins left in the whole level */
+	MovingPlatformController mpc;		/* platforms of the resident chunks */
+	EnemyController ec;				/* enemies of the resident chunks */
 } Map;
 
-static Map * g_Map = NULL;
+/*
+	a world is a game in progress, everything that changes while playing is in it. the
+	main world is the one on screen, the others are stepped without being drawn or
+	heard and can run on any thread, see world_stepAll.
+*/
+struct World
+{
+	Player player;
+	Map * map;
+	Arena mapArenas[2];				/* a map is loaded into the one the current map isn't using */
+	int curLevel;
+	int displayLevelText;
+	Timer utilTimer;
+	double time;					/* simulation clock in milliseconds, the timers run on it */
+	int shown;					/* drawn and heard, the map loader and the replays are its own */
+	WorldInputFn input;			/* gives input before every tick */
+	void * inputData;
+};
+
+static World g_World;			/* the main world */
+
+/* time on the world's clock, in milliseconds */
+static unsigned world_getTicks( World * world )
+{
+	return (unsigned) world->time;
+}
+
+/* only the main world is heard */
+static void world_playSound( World * world, Mix_Chunk * sfx )
+{
+	if ( world->shown )
+		playSound( sfx );
+}
+
+static void world_playMusic( World * world, Mix_Music * mus, int loops )
+{
+	if ( world->shown )
+		playMusic( mus, loops );
+}
+
+/************************************************************/
+
+/*
+	a frame is drawn from a snapshot of the main world rather than from the world, so
+	the drawing never reads what a tick is changing and can run on another thread than
+	the ticks. a snapshot is taken after a tick and holds what can be seen from the
+	views between the player's positions before and after it: the tiles of the cache
+	chunks the views overlap, and the platforms, enemies and coins near them. the
+	arrays only ever grow.
+*/
+typedef struct SnapshotSprite
+{
+	float prevX, prevY;				/* position before the tick */
+	float x, y;					/* position after it */
+} SnapshotSprite;
+
+typedef struct Snapshot
+{
+	int serial;					/* map the snapshot is of */
+	int width, height;				/* size of the map in tiles */
+	int level, displayLevelText;
+	int lives, score, coins;
+	int pressAnyKey;				/* the game over screen has been up long enough */
+	float playerX, playerY;			/* position of the player after the tick */
+	float playerPrevX, playerPrevY;	/* and before it */
+	Sprite player;
+	int tileX, tileY;				/* first tile copied */
+	int tileWidth, tileHeight;		/* number of tiles copied, in whole cache chunks */
+	char * tiles;					/* tiles copied, row by row */
+	char * resident;				/* the tiles of a column are known, its chunk was resident */
+	SnapshotSprite * platforms;
+	SnapshotSprite * enemies;
+	int * coinTiles;				/* tiles holding a coin, an x and a y each */
+	int platformCount, enemyCount, coinCount;
+	int tileSize, residentSize, platformSize, enemySize, coinSize;	/* room in the arrays */
+} Snapshot;
+
+static Snapshot g_snapshots[SNAPSHOT_BUFFERS];	/* of the main world */
+
+/* returns a tile of a snapshot, tiles that weren't copied are empty */
+static char snapshot_getTile( Snapshot * snap, int x, int y )
+{
+	x -= snap->tileX;
+	y -= snap->tileY;
+	if ( x < 0 || x >= snap->tileWidth || y < 0 || y >= snap->tileHeight )
+		return '.';
+
+	return snap->tiles[ y * snap->tileWidth + x ];
+}
+
+static int snapshot_isResident( Snapshot * snap, int x )
+{
+	x -= snap->tileX;
+	return x >= 0 && x < snap->tileWidth && snap->resident[x];
+}
+
+/* frees what a map holds outside its arena */
+void map_close( Map * map )
+{
+	if ( map->file != NULL )
+		fclose( map->file );
+	if ( map->level != NULL )
+		munmap( map->level, map->levelSize );
+	map->file = NULL;
+	map->level = NULL;
+}
 
 void map_cleanup( Map * map )
 {
 	if ( map == NULL ) return;
 
-	mpc_cleanup( &map->mpc );
-	cc_cleanup( &map->cc );
-	free( map->data );
+	map_close( map );
+	arena_reset( map->arena );
 }
 
-int map_load( char * filename )
+int tile_isSolid( char tile )
 {
-	FILE * fp = NULL;
-	char next;
-	int i, num_tiles = NUM_TILES;
-	
-	fp = fopen( filename, "r" );
+	switch ( tile )
+	{
+		case '#':
+		case '/':
+		case '\\':
+		case '-':
+		case '[':
+		case ']':
+		case 'X':
+		case '<':
+		case '>':
+		case 'E':
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+SDL_Rect map_getTileRect( int x, int y );
+
+/* finds the tileset image of a tile, returns 0 if the tile isn't drawn */
+int map_getTileImage( char tile, SDL_Rect * rect )
+{
+	switch ( tile )
+	{
+		case '#':  *rect = map_getTileRect( 8, 0 );  break;
+		case '/':  *rect = map_getTileRect( 8, 9 );  break;
+		case '\\': *rect = map_getTileRect( 9, 10 ); break;
+		case '-':  *rect = map_getTileRect( 3, 9 );  break;
+		case '[':  *rect = map_getTileRect( 3, 10 ); break;
+		case ']':  *rect = map_getTileRect( 4, 10 ); break;
+		case 'X':  *rect = map_getTileRect( 6, 9 );  break;
+		case '<':  *rect = map_getTileRect( 2, 11 ); break;
+		case '>':  *rect = map_getTileRect( 4, 11 ); break;
+		case 'E':  *rect = map_getTileRect( 6, 6 );  break;
+		default:   return 0;
+	}
+	return 1;
+}
+
+/* position of the player at the start of a map */
+void map_getStart( Map * map, float * x, float * y )
+{
+	*x = ( map->startPos % map->width ) * TILE_WIDTH;
+	*y = ( map->startPos / map->width ) * TILE_HEIGHT + ( TILE_HEIGHT * 2 - PLAYER_HEIGHT );
+}
+
+/* size of a bitset that covers the whole map */
+size_t map_getBitsetSize( Map * map )
+{
+	return ( map->width + BITSET_WORD_BITS - 1 ) / BITSET_WORD_BITS * map->height * sizeof( unsigned int );
+}
+
+/************************************************************/
+
+/* the camera keeps the player in the middle of the view, without showing past the map of the given size in tiles */
+
+int camera_getX( int width, float playerX )
+{
+	int x = (int) playerX + HALF_PLAYER_WIDTH - SCREEN_WIDTH / 2;
+
+	if ( x > width * TILE_WIDTH - SCREEN_WIDTH )
+		x = width * TILE_WIDTH - SCREEN_WIDTH;
+	return x < 0 ? 0 : x;
+}
+
+int camera_getY( int height, float playerY )
+{
+	int y = (int) playerY + HALF_PLAYER_HEIGHT - SCREEN_HEIGHT / 2;
+
+	if ( y > height * TILE_HEIGHT - SCREEN_HEIGHT )
+		y = height * TILE_HEIGHT - SCREEN_HEIGHT;
+	return y < 0 ? 0 : y;
+}
+
+/************************************************************/
+
+/* returns the slot holding the chunk of a column, or NULL if that chunk isn't resident */
+Chunk * map_getChunk( Map * map, int x )
+{
+	Chunk * chunk = &map->chunks[ x / MAP_CHUNK_WIDTH % MAP_CHUNK_SLOTS ];
+	return chunk->index == x / MAP_CHUNK_WIDTH ? chunk : NULL;
+}
+
+/* returns a tile of a map, tiles outside of it or of the resident chunks are empty */
+char map_getTileOf( Map * map, int x, int y )
+{
+	Chunk * chunk;
+
+	if ( x < 0 || x >= map->width || y < 0 || y >= map->height || ( chunk = map_getChunk( map, x ) ) == NULL )
+		return '.';
+
+	return chunk->tiles[ y * MAP_CHUNK_WIDTH + x % MAP_CHUNK_WIDTH ];
+}
+
+/* allocates the chunk slots and the coins once the size of the map is known, the slots of a compiled level point into its mapping instead */
+static int map_initChunks( Map * map )
+{
+	int i;
+
+	map->chunkCount = ( map->width + MAP_CHUNK_WIDTH - 1 ) / MAP_CHUNK_WIDTH;
+
+	for ( i = 0; i < MAP_CHUNK_SLOTS; i++ )
+	{
+		map->chunks[i].index = -1;
+		if ( map->level != NULL )
+			continue;
+		map->chunks[i].tiles = (char *) arena_alloc( map->arena, MAP_CHUNK_WIDTH * map->height );
+		map->chunks[i].solid = (unsigned int *) arena_alloc( map->arena, sizeof( unsigned int ) * map->height );
+		if ( map->chunks[i].tiles == NULL || map->chunks[i].solid == NULL )
+			return 1;
+	}
+
+	return cc_init( &map->cc, map->arena, map->width, map->height );
+}
+
+static unsigned int level_align( unsigned int offset );
+
+/* pages of the mapping a chunk of a compiled level lies on */
+static void map_getChunkPages( Map * map, int index, long * start, long * size )
+{
+	long page = sysconf( _SC_PAGESIZE ), offset = map->chunkOffset + index * map->chunkSize;
+
+	*start = offset & ~( page - 1 );
+	*size = ( ( offset + map->chunkSize + page - 1 ) & ~( page - 1 ) ) - *start;
+}
+
+/*
+	lets go of the pages of an evicted chunk of a compiled level, so only the resident
+	chunks take memory however far the level is played. the mapping is never written,
+	so the pages are read again from the file if they're touched, which happens when a
+	page is shared with a resident chunk. glibc's posix_madvise ignores DONTNEED, so
+	madvise is used where there is one.
+*/
+static void map_releaseChunk( Map * map, int index )
+{
+	long start, size;
+
+	map_getChunkPages( map, index, &start, &size );
+#ifdef MADV_DONTNEED
+	madvise( map->level + start, size, MADV_DONTNEED );
+#else
+	posix_madvise( map->level + start, size, POSIX_MADV_DONTNEED );
+#endif
+}
+
+/* reads a chunk into its slot, the chunk that was there is evicted along with its platforms and enemies */
+static int map_loadChunk( Map * map, int index )
+{
+	Chunk * chunk = &map->chunks[ index % MAP_CHUNK_SLOTS ];
+	int c, x, y, first = index * MAP_CHUNK_WIDTH, columns = map->width - first;
+
+	if ( chunk->index == index )
+		return 0;
+
+	if ( chunk->index != -1 )
+	{
+		mpc_removeColumns( &map->mpc, chunk->index * MAP_CHUNK_WIDTH, MAP_CHUNK_WIDTH );
+		ec_removeEnemies( &map->ec, chunk->index * MAP_CHUNK_WIDTH, MAP_CHUNK_WIDTH );
+		if ( map->level != NULL )
+			map_releaseChunk( map, chunk->index );
+	}
+	chunk->index = -1;
+
+	if ( columns > MAP_CHUNK_WIDTH )
+		columns = MAP_CHUNK_WIDTH;
+
+	if ( map->level != NULL ) /* a compiled chunk is used in place, its pages are read ahead of being touched */
+	{
+		long offset = map->chunkOffset + index * map->chunkSize, start, size;
+
+		map_getChunkPages( map, index, &start, &size );
+		posix_madvise( map->level + start, size, POSIX_MADV_WILLNEED );
+		chunk->tiles = map->level + offset;
+		chunk->solid = (unsigned int *) ( map->level + offset + level_align( MAP_CHUNK_WIDTH * map->height ) );
+	}
+	else /* a text chunk is a piece of every row, the spaces between the tiles are skipped */
+	{
+		memset( chunk->tiles, '.', MAP_CHUNK_WIDTH * map->height );
+		memset( chunk->solid, 0, sizeof( unsigned int ) * map->height );
+
+		for ( y = 0; y < map->height; y++ )
+		{
+			char * row = chunk->tiles + y * MAP_CHUNK_WIDTH;
+			int length = map->rowLengths[y] - first;
+
+			if ( map->rowLengths[y] >= 0 ) /* the row's piece is read in one go */
+			{
+				if ( length > columns )
+					length = columns;
+				if ( length > 0 && ( fseek( map->file, map->rows[y] + first, SEEK_SET ) != 0 || fread( row, 1, length, map->file ) != length ) )
+					goto read_error;
+			}
+			else
+			{
+				if ( fseek( map->file, map->rows[y], SEEK_SET ) != 0 )
+					goto read_error;
+
+				for ( x = -first; x < columns && ( c = fgetc( map->file ) ) != '\n' && c != EOF; )
+					if ( !isspace( c ) )
+					{
+						if ( x >= 0 )
+							row[x] = c;
+						x++;
+					}
+
+				if ( ferror( map->file ) )
+					goto read_error;
+			}
+
+			for ( x = 0; x < columns; x++ )
+				if ( tile_isSolid( row[x] ) )
+					chunk->solid[y] |= 1u << x;
+		}
+	}
+
+	for ( y = 0; y < map->height; y++ )
+		for ( x = 0; x < columns; x++ )
+			switch ( chunk->tiles[ y * MAP_CHUNK_WIDTH + x ] )
+			{
+				case 'H':		mpc_addPlatform( &map->mpc, y * map->width + first + x, RIGHT ); break;
+				case 'V':		mpc_addPlatform( &map->mpc, y * map->width + first + x, UP ); break;
+				case 'G':		ec_addEnemy( &map->ec, y * map->width + first + x ); break;
+			}
+
+	chunk->index = index;
+	return 0;
+
+	read_error:
+
+		fprintf( stderr, "Failed to read chunk %d of the map\n", index );
+
+	return 1;
+}
+
+/* makes the chunks in view resident, and a chunk either side so they are read before they're seen */
+void map_stream( Map * map, int viewX )
+{
+	int first = viewX / TILE_WIDTH / MAP_CHUNK_WIDTH - 1;
+	int last = ( viewX + SCREEN_WIDTH - 1 ) / TILE_WIDTH / MAP_CHUNK_WIDTH + 1;
+
+	if ( first < 0 ) first = 0;
+	if ( last >= map->chunkCount ) last = map->chunkCount - 1;
+
+	for ( ; first <= last; first++ )
+		map_loadChunk( map, first );
+}
+
+/************************************************************/
+
+/*
+	chunk cache -- the tiles are drawn CACHE_CHUNK_TILES by CACHE_CHUNK_TILES at a time
+	into surfaces that are kept in a cache, so composing a view takes a blit for each
+	chunk it overlaps however large the map is. the least recently used chunks are
+	freed when the cache goes over its limit, though never the ones of the view being
+	composed, and chunks without any tiles take no memory at all. the chunks are drawn
+	from snapshots and the cache only holds the chunks of the map drawn last, it and
+	the static layer belong to the thread that draws.
+*/
+#define CACHE_CHUNK_TILES 16
+#define CACHE_ENTRIES 128			/* far more than the chunks of a view */
+
+typedef struct CacheEntry
+{
+	int serial;					/* map of the chunk, 0 when the entry is free */
+	int x, y;					/* position in chunks */
+	SDL_Surface * surface;		/* tiles of the chunk, NULL if it has none */
+	unsigned lastUsed;			/* view the chunk was last used in */
+} CacheEntry;
+
+static CacheEntry g_cache[CACHE_ENTRIES];
+static int g_cacheSerial			= 0;				/* map the cached chunks are of */
+static size_t g_cacheUsed			= 0;				/* bytes of the cached surfaces */
+static size_t g_cachePeak			= 0;
+static size_t g_cacheLimit			= 4 * 1024 * 1024;
+static unsigned g_cacheView			= 0;				/* views composed so far */
+static long g_cacheHits				= 0;
+static long g_cacheMisses			= 0;
+
+static SDL_Surface * g_staticLayer	= NULL;			/* background and the tiles in view */
+static int g_layerX				= -1;			/* view the static layer was composed for, -1 when it has to be */
+static int g_layerY				= -1;
+
+/* the limit is kept to what the entries can hold, which is returned */
+size_t map_setCacheLimit( size_t bytes )
+{
+	size_t most = (size_t) CACHE_ENTRIES * CACHE_CHUNK_TILES * TILE_WIDTH * CACHE_CHUNK_TILES * TILE_HEIGHT * ( SCREEN_BPP / 8 );
+
+	g_cacheLimit = bytes > most ? most : bytes;
+	return g_cacheLimit;
+}
+
+static void cache_evict( CacheEntry * entry )
+{
+	if ( entry->surface != NULL )
+	{
+		g_cacheUsed -= entry->surface->pitch * entry->surface->h;
+		FreeSurface( entry->surface );
+	}
+	entry->serial = 0;
+}
+
+/* evicts the chunks of every map but one */
+static void cache_flush( int keep )
+{
+	int i;
+	for ( i = 0; i < CACHE_ENTRIES; i++ )
+		if ( g_cache[i].serial != 0 && g_cache[i].serial != keep )
+			cache_evict( &g_cache[i] );
+}
+
+/* returns the least recently used entry that isn't in the current view, free entries first */
+static CacheEntry * cache_findVictim( int withSurface )
+{
+	CacheEntry * victim = NULL;
+	int i;
+
+	for ( i = 0; i < CACHE_ENTRIES; i++ )
+	{
+		CacheEntry * entry = &g_cache[i];
+		if ( entry->serial == 0 )
+		{
+			if ( !withSurface ) return entry;
+			continue;
+		}
+		if ( entry->lastUsed == g_cacheView || ( withSurface && entry->surface == NULL ) )
+			continue;
+		if ( victim == NULL || entry->lastUsed < victim->lastUsed )
+			victim = entry;
+	}
+
+	return victim;
+}
+
+static void cache_printStats( void )
+{
+	fprintf( stdout, "Chunk cache: %ld hits, %ld misses, peak %lu of %lu bytes\n",
+		g_cacheHits, g_cacheMisses, (unsigned long) g_cachePeak, (unsigned long) g_cacheLimit );
+	g_cacheHits = g_cacheMisses = 0;
+	g_cachePeak = g_cacheUsed;
+}
+
+/* draws the tiles of a chunk into a new surface, which is NULL if there are none */
+static int cache_renderChunk( Snapshot * snap, int cx, int cy, SDL_Surface ** surface )
+{
+	SDL_Surface * created;
+	SDL_Rect src, dst;
+	int x, y, x0 = cx * CACHE_CHUNK_TILES, y0 = cy * CACHE_CHUNK_TILES;
+
+	*surface = NULL;
+
+	for ( y = y0; y < y0 + CACHE_CHUNK_TILES; y++ )
+		for ( x = x0; x < x0 + CACHE_CHUNK_TILES; x++ )
+		{
+			if ( !map_getTileImage( snapshot_getTile( snap, x, y ), &src ) )
+				continue;
+
+			if ( *surface == NULL )
+			{
+				created = SDL_CreateRGBSurface( SDL_SWSURFACE, CACHE_CHUNK_TILES * TILE_WIDTH, CACHE_CHUNK_TILES * TILE_HEIGHT, SCREEN_BPP, 0, 0, 0, 0 );
+				if ( created == NULL || ( *surface = SDL_DisplayFormat( created ) ) == NULL )
+				{
+					fprintf( stderr, "Failed to create a map chunk: %s\n", SDL_GetError() );
+					SDL_FreeSurface( created );
+					return 1;
+				}
+				SDL_FreeSurface( created );
+				SDL_FillRect( *surface, NULL, SDL_MapRGB( ( *surface )->format, 0xFF, 0x00, 0xFF ) );
+			}
+
+			dst.x = ( x - x0 ) * TILE_WIDTH;
+			dst.y = ( y - y0 ) * TILE_HEIGHT;
+			SDL_BlitSurface( g_imgTileset, &src, *surface, &dst );
+		}
+
+	/* the chunk is never drawn to again, so it can be run-length encoded */
+	if ( *surface != NULL )
+		SDL_SetColorKey( *surface, SDL_SRCCOLORKEY | SDL_RLEACCEL, SDL_MapRGB( ( *surface )->format, 0xFF, 0x00, 0xFF ) );
+
+	return 0;
+}
+
+/* finds the surface of a chunk, drawing it if it isn't cached. the surface is NULL if there is nothing to draw */
+static int cache_get( Snapshot * snap, int cx, int cy, SDL_Surface ** surface )
+{
+	CacheEntry * entry;
+	size_t size;
+	int i;
+
+	for ( i = 0; i < CACHE_ENTRIES; i++ )
+		if ( g_cache[i].serial == snap->serial && g_cache[i].x == cx && g_cache[i].y == cy )
+		{
+			g_cache[i].lastUsed = g_cacheView;
+			*surface = g_cache[i].surface;
+			g_cacheHits++;
+			return 0;
+		}
+
+	/* the tiles of a chunk that isn't resident are unknown, it's left out rather than cached empty */
+	*surface = NULL;
+	if ( !snapshot_isResident( snap, cx * CACHE_CHUNK_TILES ) )
+		return 0;
+
+	g_cacheMisses++;
+	if ( cache_renderChunk( snap, cx, cy, surface ) != 0 )
+		return 1;
+
+	/* make room, going over the limit only if the view needs more */
+	size = *surface != NULL ? ( *surface )->pitch * ( *surface )->h : 0;
+	while ( size > 0 && g_cacheUsed + size > g_cacheLimit && ( entry = cache_findVictim( 1 ) ) != NULL )
+		cache_evict( entry );
+
+	if ( ( entry = cache_findVictim( 0 ) ) == NULL )
+	{
+		fprintf( stderr, "Failed to cache a map chunk: every entry is in view\n" );
+		FreeSurface( *surface );
+		return 1;
+	}
+	cache_evict( entry );
+
+	entry->serial = snap->serial;
+	entry->x = cx;
+	entry->y = cy;
+	entry->surface = *surface;
+	entry->lastUsed = g_cacheView;
+
+	g_cacheUsed += size;
+	if ( g_cacheUsed > g_cachePeak )
+		g_cachePeak = g_cacheUsed;
+
+	return 0;
+}
+
+/* composes the background and the chunks of a view, which don't change while the view stays */
+int map_renderStatic( Snapshot * snap, int viewX, int viewY )
+{
+	SDL_Surface * chunk;
+	SDL_Rect dst;
+	int x, y;
+
+	/* the chunks of the map drawn before are never seen again */
+	if ( snap->serial != g_cacheSerial )
+	{
+		if ( g_cacheSerial != 0 )
+			cache_printStats();
+		cache_flush( snap->serial );
+		g_cacheSerial = snap->serial;
+	}
+
+	if ( g_staticLayer == NULL && ( g_staticLayer = SDL_DisplayFormat( g_imgBG ) ) == NULL )
+	{
+		fprintf( stderr, "Failed to create static layer: %s\n", SDL_GetError() );
+		return 1;
+	}
+	SDL_SetColorKey( g_staticLayer, 0, 0 );
+
+	/* the background isn't color keyed, so it covers all of the last view */
+	SDL_BlitSurface( g_imgBG, NULL, g_staticLayer, NULL );
+
+	g_cacheView++;
+	for ( y = viewY / ( TILE_HEIGHT * CACHE_CHUNK_TILES ); y <= ( viewY + SCREEN_HEIGHT - 1 ) / ( TILE_HEIGHT * CACHE_CHUNK_TILES ); y++ )
+		for ( x = viewX / ( TILE_WIDTH * CACHE_CHUNK_TILES ); x <= ( viewX + SCREEN_WIDTH - 1 ) / ( TILE_WIDTH * CACHE_CHUNK_TILES ); x++ )
+		{
+			if ( cache_get( snap, x, y, &chunk ) != 0 )
+				return 1;
+			if ( chunk == NULL )
+				continue;
+
+			dst.x = x * TILE_WIDTH * CACHE_CHUNK_TILES - viewX;
+			dst.y = y * TILE_HEIGHT * CACHE_CHUNK_TILES - viewY;
+			SDL_BlitSurface( chunk, NULL, g_staticLayer, &dst );
+		}
+
+	g_layerX = viewX;
+	g_layerY = viewY;
+
+	return 0;
+}
+
+/************************************************************/
+
+/*
+	text levels have a line per row, spaces between the tiles are skipped and lines
+	without any are left out. the map is as wide as its longest row and the shorter
+	ones are empty past their end. opening one reads it through once to measure it and
+	once more to find the rows, the coins and the ends, the tiles are read by
+	map_loadChunk.
+*/
+Map * map_openText( char * filename, Arena * arena )
+{
+	int c, x = 0, y = 0, width = 0, height = 0, startPos = -1, endPos = -1, maxPlatforms = 0, maxEnemies = 0;
+	int * platforms = NULL, * enemies = NULL;
+	long last = 0;
+	Map * map = NULL;
+
+	FILE * fp = fopen( filename, "rb" );
 	if ( fp == NULL )
 	{
 		fprintf( stderr, "Failed to open map \"%s\": file not found\n", filename );
-		return 1;
+		return NULL;
 	}
-	
-	Map * map = (Map *) malloc( sizeof( Map ) );
-	mpc_init( &map->mpc );
-	cc_init( &map->cc );
-	map->data = (char*) calloc( num_tiles, sizeof( char ) );
-	
-	int startPos = -1, endPos = -1;
-	
-	for ( i = 0; i < num_tiles; i++ )
+
+	/* measure the rows, blank lines are skipped */
+	do
+	{
+		c = fgetc( fp );
+		if ( c == '\n' || c == EOF )
+		{
+			if ( x > width )
+				width = x;
+			if ( x > 0 )
+				height++;
+			x = 0;
+		}
+		else if ( !isspace( c ) )
+			x++;
+	} while ( c != EOF );
+
+	if ( height == 0 )
+	{
+		fprintf( stderr, "Failed to load map \"%s\": no rows\n", filename );
+		goto error_cleanup;
+	}
+
+	if ( ( map = (Map *) arena_alloc( arena, sizeof( Map ) ) ) == NULL )
+		goto error_cleanup;
+
+	map->arena = arena;
+	map->width = width;
+	map->height = height;
+	if ( map_initChunks( map ) != 0 ||
+	     ( map->rows = (long *) arena_alloc( arena, sizeof( long ) * height ) ) == NULL ||
+	     ( map->rowLengths = (int *) arena_alloc( arena, sizeof( int ) * height ) ) == NULL ||
+	     ( platforms = (int *) calloc( map->chunkCount, sizeof( int ) ) ) == NULL ||
+	     ( enemies = (int *) calloc( map->chunkCount, sizeof( int ) ) ) == NULL )
+		goto error_cleanup;
+
+	/* count the platforms and enemies of each chunk so their arrays can hold the most there can be */
+	rewind( fp );
+	x = 0;
+	while ( ( c = fgetc( fp ) ) != EOF || x > 0 )
 	{
-		do 
+		if ( c == '\n' || c == EOF )
 		{
-			if ( feof( fp ) )
+			if ( x > 0 )
 			{
-				fprintf( stderr, "Unexpected end of file: %s\n", filename );
-				goto error_cleanup;
+				map->rowLengths[y] = last - map->rows[y] + 1 == x ? x : -1;
+				y++;
 			}
-			next = fgetc( fp );
-		} while ( isspace( next ) );
-		
-		switch ( next )
+			x = 0;
+			continue;
+		}
+		if ( isspace( c ) )
+			continue;
+
+		last = ftell( fp ) - 1;
+		if ( x == 0 )
+			map->rows[y] = last;
+
+		switch ( c )
 		{
-			case 'H':		mpc_addPlatform( &map->mpc, i, RIGHT ); break;
-			case 'V':		mpc_addPlatform( &map->mpc, i, UP ); break;
-			case 'C':		cc_addCoin( &map->cc, i ); break;
-		}		
-		
-		map->data[i] = next;
-		
-		if ( startPos == -1 && next == 'S' )
-			startPos = i;
-		if ( endPos == -1 && next == 'E' )
-			endPos = i;
+			case 'H':
+			case 'V':		platforms[ x / MAP_CHUNK_WIDTH ]++; break;
+			case 'G':		enemies[ x / MAP_CHUNK_WIDTH ]++; break;
+			case 'C':		cc_addCoin( &map->cc, x, y ); break;
+			case 'S':		if ( startPos == -1 ) startPos = y * width + x; break;
+			case 'E':		if ( endPos == -1 ) endPos = y * width + x; break;
+		}
+		x++;
 	}
-	
+
+	for ( x = 0; x < map->chunkCount; x++ )
+	{
+		if ( platforms[x] > maxPlatforms )
+			maxPlatforms = platforms[x];
+		if ( enemies[x] > maxEnemies )
+			maxEnemies = enemies[x];
+	}
+
 	if ( startPos == -1 )
 	{
 		fprintf( stderr, "Failed to load map \"%s\": missing starting position\n", filename );
 		goto error_cleanup;
 	}
-	
+
 	if ( endPos == -1 )
 	{
 		fprintf( stderr, "Failed to load map \"%s\": missing end position\n", filename );
 		goto error_cleanup;
 	}
+
+	if ( mpc_init( &map->mpc, arena, maxPlatforms * MAP_CHUNK_SLOTS, width ) != 0 ||
+	     ec_init( &map->ec, arena, maxEnemies * MAP_CHUNK_SLOTS, width, height ) != 0 )
+		goto error_cleanup;
+
+	free( platforms );
+	free( enemies );
+
+	map->startPos = startPos;
+	map->endPos = endPos;
+	map->file = fp;
+
+	return map;
+
+	error_cleanup:
+
+		free( platforms );
+		free( enemies );
+		fclose( fp );
+
+	return NULL;
+}
+
+/************************************************************/
+
+/*
+	compiled levels are made by levelc from the text files and are mapped. the chunks
+	are stored one after the other, each with its tiles and its solidity, and the chunk
+	slots point straight at them, so streaming a chunk only pages in its part of the
+	file. only the coins, which change during play, are copied into the arena. values are in the byte order of the machine that compiled the level and each
+	section starts on a 16 byte boundary.
+
+		header:	LevelHeader
+		coins:	bitset of the coins, laid out like the map's bitsets
+		chunks:	for each chunk: MAP_CHUNK_WIDTH * height tiles | height words of solidity
+*/
+
+static const char LEVEL_MAGIC[4]		= { 'M', 'L', 'V', 'L' };
+static const unsigned int LEVEL_VERSION	= 3;
+
+#define LEVEL_ALIGN 16
+
+typedef struct LevelHeader
+{
+	char magic[4];
+	unsigned int version;
+	unsigned int width, height;			/* size in tiles */
+	unsigned int startPos, endPos;		/* starting and end positions */
+	unsigned int coinCount;				/* number of coins */
+	unsigned int maxPlatforms;			/* most platforms in one chunk */
+	unsigned int maxEnemies;				/* most enemies in one chunk */
+	unsigned int coins;					/* offset of the coin bitset */
+	unsigned int chunks;				/* offset of the first chunk */
+	unsigned int chunkSize;				/* size of a chunk, padding included */
+	unsigned int size;					/* size of the file */
+} LevelHeader;
+
+static unsigned int level_align( unsigned int offset )
+{
+	return ( offset + LEVEL_ALIGN - 1 ) & ~( LEVEL_ALIGN - 1 );
+}
+
+static unsigned int level_getChunkSize( unsigned int height )
+{
+	return level_align( level_align( MAP_CHUNK_WIDTH * height ) + sizeof( unsigned int ) * height );
+}
+
+/* checks that a section lies within the file */
+static int level_checkSection( LevelHeader * header, unsigned int offset, size_t size )
+{
+	return offset % LEVEL_ALIGN == 0 && offset <= header->size && size <= header->size - offset;
+}
+
+/* maps a compiled level, returns NULL if it doesn't exist or can't be used */
+Map * map_openCompiled( char * filename, Arena * arena )
+{
+	struct stat st;
+	Map * map = NULL;
+
+	int fd = open( filename, O_RDONLY );
+	if ( fd == -1 )
+		return NULL;
+
+	if ( fstat( fd, &st ) != 0 || st.st_size < sizeof( LevelHeader ) )
+	{
+		fprintf( stderr, "Failed to load compiled map \"%s\": file is too small\n", filename );
+		close( fd );
+		return NULL;
+	}
+
+	char * file = (char *) mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( file == MAP_FAILED )
+	{
+		fprintf( stderr, "Failed to map \"%s\"\n", filename );
+		return NULL;
+	}
+
+	LevelHeader * header = (LevelHeader *) file;
+
+	if ( memcmp( header->magic, LEVEL_MAGIC, 4 ) != 0 || header->version != LEVEL_VERSION )
+	{
+		fprintf( stderr, "Failed to load compiled map \"%s\": not a level or unsupported version\n", filename );
+		goto error_cleanup;
+	}
+
+	if ( header->size != st.st_size || header->width == 0 || header->height == 0 || header->height > header->size ||
+	     header->startPos / header->width >= header->height || header->endPos / header->width >= header->height ||
+	     header->maxPlatforms > MAP_CHUNK_WIDTH * header->height || header->maxEnemies > MAP_CHUNK_WIDTH * header->height ||
+	     header->chunkSize != level_getChunkSize( header->height ) )
+	{
+		fprintf( stderr, "Failed to load compiled map \"%s\": bad header\n", filename );
+		goto error_cleanup;
+	}
+
+	if ( ( map = (Map *) arena_alloc( arena, sizeof( Map ) ) ) == NULL )
+		goto error_cleanup;
+
+	map->arena = arena;
+	map->width = header->width;
+	map->height = header->height;
+	map->startPos = header->startPos;
+	map->endPos = header->endPos;
+
+	if ( !level_checkSection( header, header->coins, map_getBitsetSize( map ) ) ||
+	     !level_checkSection( header, header->chunks, (size_t) ( header->width + MAP_CHUNK_WIDTH - 1 ) / MAP_CHUNK_WIDTH * header->chunkSize ) )
+	{
+		fprintf( stderr, "Failed to load compiled map \"%s\": bad section\n", filename );
+		goto error_cleanup;
+	}
+
+	/* the coins change during play so they are copied, the chunks are used from the mapping */
+	map->level = file;
+	map->levelSize = st.st_size;
+	map->chunkOffset = header->chunks;
+	map->chunkSize = header->chunkSize;
+
+	if ( map_initChunks( map ) != 0 || mpc_init( &map->mpc, arena, header->maxPlatforms * MAP_CHUNK_SLOTS, map->width ) != 0 ||
+	     ec_init( &map->ec, arena, header->maxEnemies * MAP_CHUNK_SLOTS, map->width, map->height ) != 0 )
+		goto error_cleanup;
+
+	memcpy( map->cc.tiles, file + header->coins, map_getBitsetSize( map ) );
+	map->cc.count = header->coinCount;
+
+	return map;
+
+	error_cleanup:
+
+		munmap( file, st.st_size );
+
+	return NULL;
+}
+
+/* reads a level into an empty arena, from its compiled file when there is one that is up to date */
+static int g_mapSerial			= 0;	/* serial of the last map read */
+
+Map * map_read( char * filename, Arena * arena, char * loadedFrom )
+{
+	struct stat text, compiled;
+	Map * map = NULL;
+	float x, y;
+	int i;
+
+	sprintf( loadedFrom, "%s.bin", filename );
+	if ( stat( loadedFrom, &compiled ) == 0 && ( stat( filename, &text ) != 0 || compiled.st_mtime >= text.st_mtime ) )
+		map = map_openCompiled( loadedFrom, arena );
+
+	if ( map == NULL )
+	{
+		/* a failed attempt could have left allocations behind */
+		arena_reset( arena );
+		strcpy( loadedFrom, filename );
+		map = map_openText( filename, arena );
+	}
+
+	if ( map == NULL )
+		return NULL;
+
+	/* maps are read by the loader thread and by the worlds on the workers too */
+	map->serial = __sync_add_and_fetch( &g_mapSerial, 1 );
+
+	/* the chunks around the start are read with the rest of the level */
+	map_getStart( map, &x, &y );
+	map_stream( map, camera_getX( map->width, x ) );
+
+	/* a text level that fits in the slots is read whole and doesn't need its file anymore */
+	if ( map->file != NULL && map->chunkCount <= MAP_CHUNK_SLOTS )
+	{
+		for ( i = 0; i < map->chunkCount; i++ )
+			if ( map_loadChunk( map, i ) != 0 )
+				return map;
+
+		fclose( map->file );
+		map->file = NULL;
+	}
+
+	return map;
+}
+
+/************************************************************/
+
+/*
+	the next level is always known, so it is read by a loader thread while the current
+	one is played. the thread that ticks the main world posts a request with the level
+	and the spare arena, and the loader hands the finished map back through a single
+	slot that is only ever changed with atomic swaps. nothing of a map is drawn until
+	a snapshot is taken of it, so a map is ready to play as soon as it is read.
+*/
+
+static SDL_Thread * g_loaderThread	= NULL;
+static SDL_sem * g_loaderRequest		= NULL;	/* posted for every request and to quit */
+static int g_loaderQuit				= 0;	/* set and read with atomics, like the slot */
+
+static int g_prefetchLevel			= 0;		/* level requested, set before posting */
+static Arena * g_prefetchArena		= NULL;	/* arena to read it into */
+static int g_prefetchPending			= 0;		/* request hasn't been collected, ticking thread only */
+static Map * volatile g_prefetchSlot	= NULL;	/* finished map or g_prefetchFailed */
+static Map g_prefetchFailed;
+
+static int map_loaderThread( void * data )
+{
+	char filename[20], loadedFrom[FILENAME_MAX];
 	
-	fclose( fp );
+	while ( 1 )
+	{
+		SDL_SemWait( g_loaderRequest );
+		if ( __sync_fetch_and_add( &g_loaderQuit, 0 ) )
+			break;
+		
+		sprintf( filename, "levels/level%d", g_prefetchLevel );
+		arena_reset( g_prefetchArena );
+		
+		Map * map = map_read( filename, g_prefetchArena, loadedFrom );
+		
+		__sync_bool_compare_and_swap( &g_prefetchSlot, NULL, map != NULL ? map : &g_prefetchFailed );
+	}
 	
-	map->startPos = startPos;
+	return 0;
+}
+
+int map_startLoader( void )
+{
+	if ( ( g_loaderRequest = SDL_CreateSemaphore( 0 ) ) == NULL ||
+	     ( g_loaderThread = SDL_CreateThread( map_loaderThread, NULL ) ) == NULL )
+	{
+		fprintf( stderr, "Failed to start the level loader: %s\n", SDL_GetError() );
+		return 1;
+	}
 	
-	/* clear the old map data */
-	map_cleanup( g_Map );
-	free( g_Map );
+	return 0;
+}
+
+/* waits for the pending request, returns the map if it's the level wanted */
+static Map * map_collect( int level )
+{
+	Map * map;
 	
-	/* set the new map to the new one */
-	g_Map = map;
+	if ( !g_prefetchPending )
+		return NULL;
 	
-	/* reposition the player to the start */
-	g_Player.x = ( startPos % ( SCREEN_WIDTH / TILE_WIDTH ) ) * TILE_WIDTH;
-	g_Player.y = ( startPos / ( SCREEN_WIDTH / TILE_WIDTH ) ) * TILE_HEIGHT + ( TILE_HEIGHT * 2 - PLAYER_HEIGHT );
-	g_Player.xVel = 0;
-	g_Player.yVel = 0;
-	g_Player.lastDir = RIGHT;
+	while ( ( map = __sync_lock_test_and_set( &g_prefetchSlot, NULL ) ) == NULL )
+		SDL_Delay( 1 );
+	g_prefetchPending = 0;
 	
-	fprintf( stdout, "Loaded map: %s\n", filename );
+	if ( map == &g_prefetchFailed )
+		return NULL;
 	
-	return 0;
+	if ( g_prefetchLevel != level )
+	{
+		map_close( map );
+		return NULL;
+	}
 	
-	error_cleanup:
+	return map;
+}
+
+void map_stopLoader( void )
+{
+	if ( g_loaderThread != NULL )
+	{
+		map_collect( 0 );
+		
+		__sync_lock_test_and_set( &g_loaderQuit, 1 );
+		SDL_SemPost( g_loaderRequest );
+		SDL_WaitThread( g_loaderThread, NULL );
+		g_loaderThread = NULL;
+	}
 	
-		map_cleanup( map );
-		free( map );
-		fclose( fp );
+	if ( g_loaderRequest != NULL )
+	{
+		SDL_DestroySemaphore( g_loaderRequest );
+		g_loaderRequest = NULL;
+	}
+}
 
-	return 1;
+/* starts reading a level into an arena the current map isn't using */
+static void map_prefetch( int level, Arena * arena )
+{
+	if ( g_loaderThread == NULL || g_prefetchPending )
+		return;
+	if ( arena->base == NULL && arena_init( arena, MAP_ARENA_SIZE ) != 0 )
+		return;
+	
+	g_prefetchLevel = level;
+	g_prefetchArena = arena;
+	g_prefetchPending = 1;
+	SDL_SemPost( g_loaderRequest );
+}
+
+/************************************************************/
+
+/* prints how much of its memory a map used */
+static void map_printStats( Map * map )
+{
+	fprintf( stdout, "Map arena: peak %lu of %lu bytes\n", (unsigned long) map->arena->peak, (unsigned long) map->arena->size );
 }
 
-void map_change( void )
+int map_load( World * world, int level )
 {
-	if ( ++g_curLevel > 9 ) 
-		g_curLevel = 1;
+	char filename[20], loadedFrom[FILENAME_MAX];
 	
-	char str[20];
+	sprintf( filename, "levels/level%d", level );
 	
-	/* format the string for display */
-	sprintf( str, "Level %d", g_curLevel );
-	FreeSurface( g_textLevel );
-	g_textLevel = TTF_RenderText_Solid( g_fontLarge, str, (SDL_Color) { 0xFF, 0xFF, 0xFF } );
+	/* build the map in the arena the current map isn't using */
+	Arena * arena = &world->mapArenas[ world->map != NULL && world->map->arena == &world->mapArenas[0] ];
+	if ( arena->base == NULL && arena_init( arena, MAP_ARENA_SIZE ) != 0 )
+		return 1;
+	
+	/* take the prefetched map, or read it now if it isn't the right one */
+	Map * map = world->shown ? map_collect( level ) : NULL;
+	if ( map != NULL )
+		sprintf( loadedFrom, "%s (prefetched)", filename );
+	else
+	{
+		arena_reset( arena );
+		if ( ( map = map_read( filename, arena, loadedFrom ) ) == NULL )
+			return 1;
+	}
+	
+	float x, y;
+	map_getStart( map, &x, &y );
+	
+	/* clear the old map data */
+	if ( world->shown && world->map != NULL )
+		map_printStats( world->map );
+	map_cleanup( world->map );
+	
+	/* set the new map to the new one */
+	world->map = map;
+	
+	/* reposition the player to the start */
+	world->player.x = x;
+	world->player.y = y;
+	world->player.prevX = world->player.x;
+	world->player.prevY = world->player.y;
+	world->player.xVel = 0;
+	world->player.yVel = 0;
+	world->player.lastDir = RIGHT;
+	
+	if ( !world->shown )
+		return 0;
 	
-	/* format the string for loading */
-	sprintf( str, "levels/level%d", g_curLevel );
-	map_load( str );
+	fprintf( stdout, "Loaded map: %s\n", loadedFrom );
 	
-	g_displayLevelText = 1;
-	timer_reset( &g_utilTimer );
+	/* the old map's arena is free again, read the next level into it */
+	map_prefetch( level % 9 + 1, arena == &world->mapArenas[0] ? &world->mapArenas[1] : &world->mapArenas[0] );
+	
+	return 0;
 }
 
-char map_getTile( int x, int y )
+void map_change( World * world )
 {
-	return g_Map->data[ y * ( SCREEN_WIDTH / TILE_WIDTH ) + x ];
+	if ( ++world->curLevel > 9 ) 
+		world->curLevel = 1;
+	
+	map_load( world, world->curLevel );
+	if ( world->shown )
+		replay_levelChanged( world->curLevel );
+	
+	world->displayLevelText = 1;
+	timer_reset( &world->utilTimer, world_getTicks( world ) );
 }
 
 SDL_Rect map_getTileRect( int x, int y )
@@ -388,50 +1539,82 @@ SDL_Rect map_getTileRect( int x, int y )
 	return rect;
 }
 
-int map_checkCollision( int x, int y )
+/* note: pixels outside of the map, or of its resident chunks, are never solid */
+
+int map_checkCollision( Map * map, int x, int y )
+{
+	/* negative coordinates wrap around and fail the bounds check */
+	unsigned tx = (unsigned) x / TILE_WIDTH, ty = (unsigned) y / TILE_HEIGHT;
+	Chunk * chunk;
+	
+	if ( tx >= map->width || ty >= map->height || ( chunk = map_getChunk( map, tx ) ) == NULL )
+		return 0;
+	
+	return ( chunk->solid[ ty ] >> ( tx % MAP_CHUNK_WIDTH ) ) & 1;
+}
+
+/* checks if any pixel from x0 to x1 on row y is solid */
+int map_checkRow( Map * map, int x0, int x1, int y )
 {
-	switch ( map_getTile( x / TILE_WIDTH, y / TILE_HEIGHT ) )
+	unsigned ty = (unsigned) y / TILE_HEIGHT;
+	int tx0 = x0 < 0 ? 0 : x0 / TILE_WIDTH;
+	int tx1 = x1 / TILE_WIDTH;
+	int word;
+	
+	if ( ty >= map->height || x1 < 0 || tx0 >= map->width ) 
+		return 0;
+	if ( tx1 >= map->width )
+		tx1 = map->width - 1;
+	
+	/* a chunk holds a word per row, mask off the columns of each word that are outside the range */
+	for ( word = tx0 / MAP_CHUNK_WIDTH; word <= tx1 / MAP_CHUNK_WIDTH; word++ )
 	{
-		case '#':
-		case '/':
-		case '\\':
-		case '-':
-		case '[':
-		case ']':
-		case 'X':
-		case '<':
-		case '>':
-		case 'E':
+		Chunk * chunk = map_getChunk( map, word * MAP_CHUNK_WIDTH );
+		unsigned int mask = ~0u;
+		if ( word == tx0 / MAP_CHUNK_WIDTH )
+			mask &= ~0u << ( tx0 % MAP_CHUNK_WIDTH );
+		if ( word == tx1 / MAP_CHUNK_WIDTH )
+			mask &= ~0u >> ( MAP_CHUNK_WIDTH - 1 - tx1 % MAP_CHUNK_WIDTH );
+		
+		if ( chunk != NULL && ( chunk->solid[ ty ] & mask ) )
 			return 1;
-		default: 	
-			return 0;
 	}
+	
+	return 0;
+}
+
+/* checks if any pixel from y0 to y1 on column x is solid */
+int map_checkColumn( Map * map, int x, int y0, int y1 )
+{
+	unsigned tx = (unsigned) x / TILE_WIDTH;
+	int ty0 = y0 < 0 ? 0 : y0 / TILE_HEIGHT;
+	int ty1 = y1 / TILE_HEIGHT;
+	Chunk * chunk;
+	
+	if ( tx >= map->width || y1 < 0 || ( chunk = map_getChunk( map, tx ) ) == NULL )
+		return 0;
+	if ( ty1 >= map->height )
+		ty1 = map->height - 1;
+	
+	/* the rows of a column are consecutive words of the same chunk */
+	unsigned int bit = 1u << ( tx % MAP_CHUNK_WIDTH );
+	for ( ; ty0 <= ty1; ty0++ )
+		if ( chunk->solid[ ty0 ] & bit )
+			return 1;
+	
+	return 0;
 }
 
-void map_draw( void )
+void map_draw( Snapshot * snap, int viewX, int viewY )
 {
-	int i = 0, max = NUM_TILES, x, y;
-	SDL_Rect rect;
-	for ( i = 0; i < max; i++ )
+	/* a view that moved, or of another map, is composed again, and then has to be drawn in full */
+	if ( snap->serial != g_cacheSerial || viewX != g_layerX || viewY != g_layerY )
 	{
-		switch ( g_Map->data[ i ] )
-		{
-			case '#':  rect = map_getTileRect( 8, 0 );  break;
-			case '/':  rect = map_getTileRect( 8, 9 );  break;
-			case '\\': rect = map_getTileRect( 9, 10 ); break;
-			case '-':  rect = map_getTileRect( 3, 9 );  break;
-			case '[':  rect = map_getTileRect( 3, 10 ); break;
-			case ']':  rect = map_getTileRect( 4, 10 ); break;
-			case 'X':  rect = map_getTileRect( 6, 9 );  break;
-			case '<':  rect = map_getTileRect( 2, 11 ); break;
-			case '>':  rect = map_getTileRect( 4, 11 ); break;
-			case 'E':  rect = map_getTileRect( 6, 6 );  break;
-			default:   continue;
-		}
-		x = ( i % ( SCREEN_WIDTH / TILE_WIDTH ) ) * TILE_WIDTH;
-		y = ( i / ( SCREEN_WIDTH / TILE_WIDTH ) ) * TILE_HEIGHT;
-		drawImage( g_imgTileset, &rect, x, y );
+		map_renderStatic( snap, viewX, viewY );
+		screen_invalidate();
 	}
+	
+	drawBackground( g_staticLayer );
 }
 
 /************************************************************/
@@ -501,274 +1684,394 @@ SDL_Rect anim_getRect( Animation anim, int frame )
 
 /************************************************************/
 
-void cc_update( void )
+void cc_update( World * world )
 {
-	CoinController * cc = &g_Map->cc;
-	SDL_Rect player = rect( g_Player.x, g_Player.y, PLAYER_WIDTH, PLAYER_HEIGHT );
-
-	int i;	
-	for ( i = 0; i < cc->size; i++ )
-		if ( cc->array[i] != -1 )
-		{
-			int x, y;
-			x = cc->array[i] % ( SCREEN_WIDTH / TILE_WIDTH ) * TILE_WIDTH;
-			y = cc->array[i] / ( SCREEN_WIDTH / TILE_WIDTH ) * TILE_HEIGHT;
-			
-			if ( rect_intersect( player, rect( x, y, TILE_WIDTH, TILE_HEIGHT ) ) )
+	CoinController * cc = &world->map->cc;
+	SDL_Rect player = rect( world->player.x, world->player.y, PLAYER_WIDTH, PLAYER_HEIGHT );
+	
+	/* only the tiles within one tile of the player's box can hold a touching coin */
+	int x0 = player.x < TILE_WIDTH ? 0 : ( player.x - TILE_WIDTH ) / TILE_WIDTH;
+	int y0 = player.y < TILE_HEIGHT ? 0 : ( player.y - TILE_HEIGHT ) / TILE_HEIGHT;
+	int x1 = ( player.x + player.w ) / TILE_WIDTH;
+	int y1 = ( player.y + player.h ) / TILE_HEIGHT;
+	int x, y;
+	
+	if ( x1 < 0 || y1 < 0 ) return;
+	if ( x1 >= world->map->width ) x1 = world->map->width - 1;
+	if ( y1 >= world->map->height ) y1 = world->map->height - 1;
+	
+	for ( x = x0; x <= x1; x++ )
+		for ( y = y0; y <= y1; y++ )
+			if ( bitset_test( cc->tiles, cc->height, x, y ) &&
+				rect_intersect( player, rect( x * TILE_WIDTH, y * TILE_HEIGHT, TILE_WIDTH, TILE_HEIGHT ) ) )
 			{
-				cc->array[i] = -1;
-				if ( ++g_Player.coins % COINS_PER_LIFE == 0 )
+				cc_removeCoin( cc, x, y );
+				if ( ++world->player.coins % COINS_PER_LIFE == 0 )
 				{
-					if ( ++g_Player.lives <= MAX_PLAYER_LIVES )
-						playSound( g_sfx1Up );
+					if ( ++world->player.lives <= MAX_PLAYER_LIVES )
+						world_playSound( world, g_sfx1Up );
 					else
-						g_Player.lives = MAX_PLAYER_LIVES;
+						world->player.lives = MAX_PLAYER_LIVES;
 				}
 				else
-					playSound( g_sfxCoin );
+					world_playSound( world, g_sfxCoin );
 			}
-		}
 }
 
-void cc_draw( void )
+void cc_draw( Snapshot * snap, int viewX, int viewY )
 {
-	CoinController * cc = &g_Map->cc;
-
+	SDL_Rect COIN_RECT = map_getTileRect( 7, 1 );
+	
+	/* the snapshot has the coins near the view, only the ones on the tiles in it are drawn */
+	int x0 = viewX / TILE_WIDTH, x1 = ( viewX + SCREEN_WIDTH - 1 ) / TILE_WIDTH;
+	int y0 = viewY / TILE_HEIGHT, y1 = ( viewY + SCREEN_HEIGHT - 1 ) / TILE_HEIGHT;
 	int i;
-	for ( i = 0; i < cc->count; i++ )
-		if ( cc->array[i] != -1 )
-		{
-			int x, y;
-			x = cc->array[i] % ( SCREEN_WIDTH / TILE_WIDTH ) * TILE_WIDTH;
-			y = cc->array[i] / ( SCREEN_WIDTH / TILE_WIDTH ) * TILE_HEIGHT;
-			
-			SDL_Rect COIN_RECT = map_getTileRect( 7, 1 );
-			drawImage( g_imgTileset, &COIN_RECT, x, y );
-		}
+	
+	for ( i = 0; i < snap->coinCount; i++ )
+	{
+		int x = snap->coinTiles[ i * 2 ], y = snap->coinTiles[ i * 2 + 1 ];
+		if ( x >= x0 && x <= x1 && y >= y0 && y <= y1 )
+			draw_queue( g_imgTileset, &COIN_RECT, x * TILE_WIDTH - viewX, y * TILE_HEIGHT - viewY, DRAW_LAYER_COINS );
+	}
 }
 
 /************************************************************/
 
-int mp_update( MovingPlatform * mp, unsigned deltaTicks )
-{	
-     SDL_Rect r = rect( mp->x, mp->y, TILE_WIDTH, TILE_HEIGHT );
-     int precheck = ( g_Player.onPlatform && ( 
-                      rect_contains( r, g_Player.x, g_Player.y + PLAYER_HEIGHT ) ||
-	                 rect_contains( r, g_Player.x + HALF_PLAYER_WIDTH, g_Player.y + PLAYER_HEIGHT ) ||
-	                 rect_contains( r, g_Player.x + PLAYER_WIDTH, g_Player.y + PLAYER_HEIGHT ) ) );
-
-	int calcX, calcY;
+/*
+	the platforms are updated in three passes: the kernel moves every platform along
+	its direction, then each platform that ran into a wall or a 'd' tile is turned
+	around, then the player is carried by the platform they were standing on. the
+	carry pass tests against the positions saved by game_saveState, which are the
+	positions from before the move.
+*/
+void mpc_update( World * world, float deltaTicks )
+{
+	MovingPlatformController * mpc = &world->map->mpc;
 	float inc = PLATFORM_MOVE_SPEED * ( deltaTicks / 1000.0f );
-	switch ( mp->dir )
+
+	/* move every platform */
+	simd_addScaled( mpc->x, mpc->dx, inc, mpc->count );
+	simd_addScaled( mpc->y, mpc->dy, inc, mpc->count );
+
+	/* turn around the platforms that hit something */
+	int i, calcX, calcY;
+	for ( i = 0; i < mpc->count; i++ )
 	{
-		case UP:
-			mp->y += -inc;
-			calcX = ( mp->x + ( TILE_WIDTH / 2 ) );
-			calcY = mp->y ;
-		break;
-		case DOWN:
-			mp->y += inc;
-			calcX = ( mp->x + ( TILE_WIDTH / 2 ) );
-			calcY = mp->y + TILE_HEIGHT;
-		break;
-		case LEFT:
-			mp->x += -inc;
-			calcX = mp->x;
-			calcY = ( mp->y + ( TILE_HEIGHT / 2 ) );
-		break;
-		case RIGHT:
-			mp->x += inc;
-			calcX = mp->x + TILE_WIDTH;
-			calcY = ( mp->y + ( TILE_HEIGHT / 2 ) );
-		break;
+		switch ( mpc->dir[i] )
+		{
+			case UP:
+				calcX = ( mpc->x[i] + ( TILE_WIDTH / 2 ) );
+				calcY = mpc->y[i];
+			break;
+			case DOWN:
+				calcX = ( mpc->x[i] + ( TILE_WIDTH / 2 ) );
+				calcY = mpc->y[i] + TILE_HEIGHT;
+			break;
+			case LEFT:
+				calcX = mpc->x[i];
+				calcY = ( mpc->y[i] + ( TILE_HEIGHT / 2 ) );
+			break;
+			default:
+			case RIGHT:
+				calcX = mpc->x[i] + TILE_WIDTH;
+				calcY = ( mpc->y[i] + ( TILE_HEIGHT / 2 ) );
+			break;
+		}
+		
+		if ( map_getTileOf( world->map, calcX / TILE_WIDTH, calcY / TILE_HEIGHT ) == 'd' || map_checkCollision( world->map, calcX, calcY ) )
+			mpc_setDirection( mpc, i, dir_getOpposite( mpc->dir[i] ) );
 	}
 	
-	if ( map_getTile( calcX / TILE_WIDTH, calcY / TILE_HEIGHT ) == 'd' || map_checkCollision( calcX, calcY ) )
-		mp->dir = dir_getOpposite( mp->dir );
-		
-	if ( g_Player.jump != JUMPING && ( precheck || (
-	     rect_contains( r, g_Player.x, g_Player.y + PLAYER_HEIGHT ) ||
-	     rect_contains( r, g_Player.x + HALF_PLAYER_WIDTH, g_Player.y + PLAYER_HEIGHT ) ||
-	     rect_contains( r, g_Player.x + PLAYER_WIDTH, g_Player.y + PLAYER_HEIGHT ) ) ) )
-     {
-          if ( mp->dir == LEFT )
-               g_Player.x -= inc;
-          else if ( mp->dir == RIGHT )
-               g_Player.x += inc;
-               
-          g_Player.y = mp->y - PLAYER_HEIGHT;       
-          return 1;
-     }
-     
-     /* 
-          there are two bugs with moving block platforms: 
-               (1) the player doesn't move horizontally with the platform and 
-                    - because of int to float conversion and back, the player doesn't move along with the platform
-               (2) when the platform is going down, the player switches between falling and not falling 
-     */
-     
-     return 0;
+	/* carry the player */
+	int onPlatform = 0;
+	if ( world->player.jump != JUMPING )
+		for ( i = 0; i < mpc->count; i++ )
+		{
+			SDL_Rect r = rect( mpc->prevX[i], mpc->prevY[i], TILE_WIDTH, TILE_HEIGHT );
+			if ( !rect_contains( r, world->player.x, world->player.y + PLAYER_HEIGHT ) &&
+			     !rect_contains( r, world->player.x + HALF_PLAYER_WIDTH, world->player.y + PLAYER_HEIGHT ) &&
+			     !rect_contains( r, world->player.x + PLAYER_WIDTH, world->player.y + PLAYER_HEIGHT ) )
+				continue;
+			
+			if ( mpc->dir[i] == LEFT )
+				world->player.x -= inc;
+			else if ( mpc->dir[i] == RIGHT )
+				world->player.x += inc;
+			
+			world->player.y = mpc->y[i] - PLAYER_HEIGHT;
+			onPlatform = 1;
+		}
+	
+	/* 
+		there are two bugs with moving block platforms: 
+			(1) the player doesn't move horizontally with the platform and 
+				- because of int to float conversion and back, the player doesn't move along with the platform
+			(2) when the platform is going down, the player switches between falling and not falling 
+	*/
+			
+	if ( ( world->player.onPlatform = onPlatform ) )
+	{
+	     world->player.jump = CAN_JUMP;
+	     world->player.yVel = 0;
+	}
 }
 
-void mp_draw( MovingPlatform * mp )
+void mpc_draw( Snapshot * snap, float alpha, int viewX, int viewY )
 {
 	SDL_Rect PLATFORM_RECT = map_getTileRect( 5, 9 );
-	drawImage( g_imgTileset, &PLATFORM_RECT, mp->x, mp->y );
+
+	int i;
+	for ( i = 0; i < snap->platformCount; i++ )
+	{
+		SnapshotSprite * platform = &snap->platforms[i];
+		int x = (int) ( platform->prevX + ( platform->x - platform->prevX ) * alpha ) - viewX;
+		int y = (int) ( platform->prevY + ( platform->y - platform->prevY ) * alpha ) - viewY;
+		
+		if ( x > -TILE_WIDTH && x < SCREEN_WIDTH && y > -TILE_HEIGHT && y < SCREEN_HEIGHT )
+			draw_queue( g_imgTileset, &PLATFORM_RECT, x, y, DRAW_LAYER_PLATFORMS );
+	}
 }
 
-void mpc_update( unsigned deltaTicks )
+/************************************************************/
+
+void player_kill( World * world );
+
+/*
+	the enemies are updated in passes over the arrays: the kernel moves every enemy
+	along its direction and its falling speed, then each enemy is checked against the
+	tiles, turning around at walls and 'd' tiles and landing on or walking off the
+	ground, then the player's box is checked against every enemy, and last the enemies
+	that are gone are removed in one sweep. enemies off the resident chunks are held
+	in place so they don't fall through tiles that aren't there.
+*/
+void ec_update( World * world, float deltaTicks )
 {
-	MovingPlatformController * mpc = &g_Map->mpc;
+	EnemyController * ec = &world->map->ec;
+	Player * player = &world->player;
+	float inc = ENEMY_MOVE_SPEED * ( deltaTicks / 1000.0f );
+	float accel = deltaTicks / REFERENCE_FRAME_TIME;
+	int i, removed = 0;
+
+	/* move every enemy */
+	simd_addScaled( ec->x, ec->dx, inc, ec->count );
+	simd_addScaled( ec->y, ec->yVel, deltaTicks / 1000.0f, ec->count );
+
+	/* turn around, land and fall */
+	for ( i = 0; i < ec->count; i++ )
+	{
+		int calcX = ec->dx[i] > 0 ? ec->x[i] + ENEMY_WIDTH : ec->x[i];
+		int calcY = ec->y[i] + ENEMY_HEIGHT / 2;
+		int feet = ec->y[i] + ENEMY_HEIGHT;
 
-	int i, onPlatform = 0;
-	for ( i = 0; i < mpc->count; i++ )
-		if ( mpc->array[i] != NULL )
-			onPlatform = mp_update( mpc->array[i], deltaTicks ) || onPlatform;
-			
-	if ( ( g_Player.onPlatform = onPlatform ) )
+		if ( map_getChunk( world->map, ( (int) ec->x[i] + ENEMY_WIDTH / 2 ) / TILE_WIDTH ) == NULL )
+		{
+			ec->x[i] = ec->prevX[i];
+			ec->y[i] = ec->prevY[i];
+			continue;
+		}
+
+		if ( calcX < 0 || calcX >= world->map->width * TILE_WIDTH ||
+		     map_getTileOf( world->map, calcX / TILE_WIDTH, calcY / TILE_HEIGHT ) == 'd' || map_checkCollision( world->map, calcX, calcY ) )
+			ec->dx[i] = -ec->dx[i];
+
+		if ( ec->yVel[i] >= 0 && map_checkRow( world->map, ec->x[i], ec->x[i] + ENEMY_WIDTH - 1, feet ) )
+		{
+			ec->y[i] = feet / TILE_HEIGHT * TILE_HEIGHT - ENEMY_HEIGHT;
+			ec->yVel[i] = 0;
+		}
+		else if ( ( ec->yVel[i] += ENEMY_FALL_SPEED * accel ) > ENEMY_MAX_FALL_SPEED )
+			ec->yVel[i] = ENEMY_MAX_FALL_SPEED;
+
+		if ( ec->y[i] > world->map->height * TILE_HEIGHT )
+		{
+			bitset_set( ec->gone, ec->height, ec->startPos[i] % ec->width, ec->startPos[i] / ec->width );
+			removed = 1;
+		}
+	}
+
+	/* stomp the enemies the player lands on, any other touch kills the player */
+	for ( i = 0; i < ec->count && !player->dead && player->lives >= 0; i++ )
 	{
-	     g_Player.jump = CAN_JUMP;
-	     g_Player.yVel = 0;
+		if ( player->x + PLAYER_WIDTH <= ec->x[i] || ec->x[i] + ENEMY_WIDTH <= player->x ||
+		     player->y + PLAYER_HEIGHT <= ec->y[i] || ec->y[i] + ENEMY_HEIGHT <= player->y ||
+		     bitset_test( ec->gone, ec->height, ec->startPos[i] % ec->width, ec->startPos[i] / ec->width ) )
+			continue;
+
+		if ( player->yVel > 0 && player->prevY + PLAYER_HEIGHT <= ec->prevY[i] + ENEMY_HEIGHT / 2 )
+		{
+			bitset_set( ec->gone, ec->height, ec->startPos[i] % ec->width, ec->startPos[i] / ec->width );
+			removed = 1;
+
+			player->yVel = -ENEMY_STOMP_SPEED;
+			player->jump = JUMPED;
+			player->score += ENEMY_STOMP_SCORE;
+			world_playSound( world, g_sfxStomp );
+		}
+		else
+			player_kill( world );
 	}
+
+	if ( removed )
+		ec_removeEnemies( ec, 0, 0 );
 }
 
-void mpc_draw( void )
+void ec_draw( Snapshot * snap, float alpha, int viewX, int viewY )
 {
-	MovingPlatformController * mpc = &g_Map->mpc;
-
 	int i;
-	for ( i = 0; i < mpc->count; i++ )
-		if ( mpc->array[i] != NULL )
-			mp_draw( mpc->array[i] );
+
+	for ( i = 0; i < snap->enemyCount; i++ )
+	{
+		SnapshotSprite * enemy = &snap->enemies[i];
+		int x = (int) ( enemy->prevX + ( enemy->x - enemy->prevX ) * alpha ) - viewX;
+		int y = (int) ( enemy->prevY + ( enemy->y - enemy->prevY ) * alpha ) - viewY;
+
+		/* the walk cycle follows the distance walked, three frames a tile */
+		SDL_Rect frame = rect( ( (int) enemy->x * 3 / TILE_WIDTH % 3 ) * ENEMY_WIDTH, 0, ENEMY_WIDTH, ENEMY_HEIGHT );
+
+		if ( x > -ENEMY_WIDTH && x < SCREEN_WIDTH && y > -ENEMY_HEIGHT && y < SCREEN_HEIGHT )
+			draw_queue( g_imgEnemy, &frame, x, y, DRAW_LAYER_ENEMIES );
+	}
 }
 
 /************************************************************/
 
-void player_init( void )
-{
-	g_Player.x = 0;
-	g_Player.y = 0;
-	g_Player.xVel = 0;
-	g_Player.yVel = 0;
-	g_Player.lastDir = RIGHT;
-	g_Player.lives = INIT_PLAYER_LIVES;
-	g_Player.time = 0;
-	g_Player.score = 0;
-	g_Player.coins = 0;
-	g_Player.dead = 0;
-	g_Player.frame = 0;
-	g_Player.frameTimer.tick = 0;
-	g_Player.frameTimer.interval = PLAYER_FRAME_TIME;
-	g_Player.sprite.image = g_imgPlayer;
-	g_Player.jump = CAN_JUMP;
-	g_Player.onPlatform = 0;
-	g_Player.keyPressed[0] = g_Player.keyPressed[1] = g_Player.keyPressed[2] = g_Player.keyPressed[3] = 0;
-}
-
-void player_kill( void )
+void player_init( World * world )
+{
+	world->player.x = 0;
+	world->player.y = 0;
+	world->player.prevX = 0;
+	world->player.prevY = 0;
+	world->player.xVel = 0;
+	world->player.yVel = 0;
+	world->player.lastDir = RIGHT;
+	world->player.lives = INIT_PLAYER_LIVES;
+	world->player.time = 0;
+	world->player.score = 0;
+	world->player.coins = 0;
+	world->player.dead = 0;
+	world->player.frame = 0;
+	world->player.frameTimer.tick = 0;
+	world->player.frameTimer.interval = PLAYER_FRAME_TIME;
+	world->player.sprite.image = g_imgPlayer;
+	world->player.jump = CAN_JUMP;
+	world->player.onPlatform = 0;
+	world->player.keyPressed[0] = world->player.keyPressed[1] = world->player.keyPressed[2] = world->player.keyPressed[3] = 0;
+}
+
+void player_kill( World * world )
 {
 #ifndef DISABLE_DEATH
-	g_Player.dead = 1;
-	Mix_PlayMusic( g_musDeath, 1 );
-	timer_reset( &g_utilTimer );
+	world->player.dead = 1;
+	world_playMusic( world, g_musDeath, 1 );
+	timer_reset( &world->utilTimer, world_getTicks( world ) );
 #else
-	g_Player.x = ( g_Map->startPos % ( SCREEN_WIDTH / TILE_WIDTH ) ) * TILE_WIDTH;
-	g_Player.y = ( g_Map->startPos / ( SCREEN_WIDTH / TILE_WIDTH ) ) * TILE_HEIGHT + ( TILE_HEIGHT * 2 - PLAYER_HEIGHT );
-	g_Player.xVel = 0;
-	g_Player.yVel = 0;
-	g_Player.lastDir = RIGHT;
+	map_getStart( world->map, &world->player.x, &world->player.y );
+	world->player.prevX = world->player.x;
+	world->player.prevY = world->player.y;
+	world->player.xVel = 0;
+	world->player.yVel = 0;
+	world->player.lastDir = RIGHT;
 	
-	g_Player.onPlatform = 0;
+	world->player.onPlatform = 0;
 
-	mpc_reset( &g_Map->mpc );
+	mpc_reset( &world->map->mpc );
+	ec_reset( &world->map->ec );
 #endif
 }
 
-void player_reset( void )
+void player_reset( World * world )
 {
-     g_Player.dead = 0;
-
-     g_Player.x = ( g_Map->startPos % ( SCREEN_WIDTH / TILE_WIDTH ) ) * TILE_WIDTH;
-     g_Player.y = ( g_Map->startPos / ( SCREEN_WIDTH / TILE_WIDTH ) ) * TILE_HEIGHT + ( TILE_HEIGHT * 2 - PLAYER_HEIGHT );
-     g_Player.xVel = 0;
-     g_Player.yVel = 0;
-     g_Player.lastDir = RIGHT;
+     world->player.dead = 0;
+
+     map_getStart( world->map, &world->player.x, &world->player.y );
+     world->player.prevX = world->player.x;
+     world->player.prevY = world->player.y;
+     world->player.xVel = 0;
+     world->player.yVel = 0;
+     world->player.lastDir = RIGHT;
      
-     g_Player.onPlatform = 0;
+     world->player.onPlatform = 0;
      
      int i;
      for ( i = 0; i < 4; i++ )
-          g_Player.keyPressed[i] = 0;
+          world->player.keyPressed[i] = 0;
 }
 
-void player_update( unsigned deltaTicks )
+void player_update( World * world, float deltaTicks )
 {
+	/* the accelerations were tuned for one step per reference frame */
+	float accel = deltaTicks / REFERENCE_FRAME_TIME;
+	
 	/* reset the player's position after death music finished */
-	if ( g_Player.dead && g_Player.lives >= 0 && !Mix_PlayingMusic() )
+	if ( world->player.dead && world->player.lives >= 0 && timer_getElapsedTime( &world->utilTimer, world_getTicks( world ) ) >= DEATH_TIME )
 	{
-		if ( --g_Player.lives >= 0 )
+		if ( --world->player.lives >= 0 )
 		{
-               player_reset();
+               player_reset( world );
 		
-			mpc_reset( &g_Map->mpc );
+			mpc_reset( &world->map->mpc );
+			ec_reset( &world->map->ec );
 			
-			g_displayLevelText = 1;
-			timer_reset( &g_utilTimer );
+			world->displayLevelText = 1;
+			timer_reset( &world->utilTimer, world_getTicks( world ) );
 		}
 		else /* no more lives, play game over music */
-			Mix_PlayMusic( g_musGameOver, 1 );
+		{
+			world_playMusic( world, g_musGameOver, 1 );
+			timer_reset( &world->utilTimer, world_getTicks( world ) );
+		}
 	}
 	
 	/* if player is dead, go no further */
-	if ( g_Player.dead || g_Player.lives < 0 ) return;
+	if ( world->player.dead || world->player.lives < 0 ) return;
 
 	/* check if player died */
-	if ( SCREEN_HEIGHT < (int) g_Player.y )
-	     player_kill();
+	if ( world->map->height * TILE_HEIGHT < (int) world->player.y )
+	     player_kill( world );
 	
-	if ( !g_Player.onPlatform )
+	if ( !world->player.onPlatform )
 	{
-	     if ( g_Player.jump == JUMPING )
+	     if ( world->player.jump == JUMPING )
 	     {
-		     g_Player.yVel += -PLAYER_JUMP_SPEED;
-		     if ( !g_Player.keyPressed[UP] || g_Player.yVel <= -PLAYER_MAX_JUMP_SPEED )
-			     g_Player.jump = JUMPED;
+		     world->player.yVel += -PLAYER_JUMP_SPEED * accel;
+		     if ( !world->player.keyPressed[UP] || world->player.yVel <= -PLAYER_MAX_JUMP_SPEED )
+			     world->player.jump = JUMPED;
 	     }
-	     else if ( g_Player.jump == JUMPED )
-		     g_Player.yVel += PLAYER_FALL_SPEED;
+	     else if ( world->player.jump == JUMPED )
+		     world->player.yVel += PLAYER_FALL_SPEED * accel;
 	}
 		
 	/* set the player's move speed if left or right (but not both) are pressed */
-	if ( ( g_Player.keyPressed[LEFT] || g_Player.keyPressed[RIGHT] ) && 
-	     !( g_Player.keyPressed[LEFT] && g_Player.keyPressed[RIGHT] ) )
+	if ( ( world->player.keyPressed[LEFT] || world->player.keyPressed[RIGHT] ) && 
+	     !( world->player.keyPressed[LEFT] && world->player.keyPressed[RIGHT] ) )
 	{
-	     g_Player.lastDir = g_Player.keyPressed[RIGHT] ? RIGHT : LEFT;
-	     if ( g_Player.lastDir == RIGHT )
+	     world->player.lastDir = world->player.keyPressed[RIGHT] ? RIGHT : LEFT;
+	     if ( world->player.lastDir == RIGHT )
 	     {
-               g_Player.xVel += PLAYER_MOVE_SPEED;
-               if ( g_Player.xVel >= PLAYER_MAX_MOVE_SPEED )
-                    g_Player.xVel = PLAYER_MAX_MOVE_SPEED;
+               world->player.xVel += PLAYER_MOVE_SPEED * accel;
+               if ( world->player.xVel >= PLAYER_MAX_MOVE_SPEED )
+                    world->player.xVel = PLAYER_MAX_MOVE_SPEED;
           }
           else
           {
-               g_Player.xVel += -PLAYER_MOVE_SPEED;
-               if ( g_Player.xVel <= -PLAYER_MAX_MOVE_SPEED )
-                    g_Player.xVel = -PLAYER_MAX_MOVE_SPEED;
+               world->player.xVel += -PLAYER_MOVE_SPEED * accel;
+               if ( world->player.xVel <= -PLAYER_MAX_MOVE_SPEED )
+                    world->player.xVel = -PLAYER_MAX_MOVE_SPEED;
           }
      }
 	else /* not pressing movement key, revert back to zero */
 	{
-	     if ( g_Player.lastDir == RIGHT )
+	     if ( world->player.lastDir == RIGHT )
 	     {
-	          g_Player.xVel += -PLAYER_MOVE_SPEED;
-	          if ( g_Player.xVel <= 0 )
-	               g_Player.xVel = 0;
+	          world->player.xVel += -PLAYER_MOVE_SPEED * accel;
+	          if ( world->player.xVel <= 0 )
+	               world->player.xVel = 0;
 	     }
 	     else
 	     {
-	          g_Player.xVel += PLAYER_MOVE_SPEED;
-	          if ( g_Player.xVel >= 0 )
-	               g_Player.xVel = 0;
+	          world->player.xVel += PLAYER_MOVE_SPEED * accel;
+	          if ( world->player.xVel >= 0 )
+	               world->player.xVel = 0;
 	     }
 	}
 	
@@ -786,152 +2089,152 @@ void player_update( unsigned deltaTicks )
 		http://games.greggman.com/game/programming_m_c__kids/
 	*/
 	
-	if ( !g_Player.onPlatform )
+	if ( !world->player.onPlatform )
 	{
-	     if ( g_Player.yVel != 0 )
+	     if ( world->player.yVel != 0 )
 	     {	
-          	int yNew = g_Player.y + g_Player.yVel * ( deltaTicks / 1000.f );
+          	float yNew = world->player.y + world->player.yVel * ( deltaTicks / 1000.f );
 	
 	          /* downward tile collision */
-	          if ( map_checkCollision( g_Player.x + HALF_PLAYER_WIDTH, yNew + PLAYER_HEIGHT ) || /* check bot-mid, or */
-		          map_checkCollision( g_Player.x, yNew + PLAYER_HEIGHT ) || /* bot-left if facing right, or */
-		          map_checkCollision( g_Player.x + PLAYER_WIDTH - 1, yNew + PLAYER_HEIGHT ) ) /* bot-right if facing left */
+	          if ( map_checkRow( world->map, world->player.x, world->player.x + PLAYER_WIDTH - 1, yNew + PLAYER_HEIGHT ) ) /* check the bottom edge */
 	          {
-		          yNew = ( yNew / TILE_HEIGHT ) * TILE_HEIGHT + ( TILE_HEIGHT * 2 - PLAYER_HEIGHT );
-		          while ( map_checkCollision( g_Player.x + HALF_PLAYER_WIDTH, yNew ) || map_checkCollision( g_Player.x + HALF_PLAYER_WIDTH, yNew + PLAYER_HEIGHT - 1 ) )
+		          yNew = ( (int) yNew / TILE_HEIGHT ) * TILE_HEIGHT + ( TILE_HEIGHT * 2 - PLAYER_HEIGHT );
+		          while ( map_checkCollision( world->map, world->player.x + HALF_PLAYER_WIDTH, yNew ) || map_checkCollision( world->map, world->player.x + HALF_PLAYER_WIDTH, yNew + PLAYER_HEIGHT - 1 ) )
 			          yNew -= TILE_HEIGHT;
-		          g_Player.yVel = 0;
-		          g_Player.jump = CAN_JUMP;
+		          world->player.yVel = 0;
+		          world->player.jump = CAN_JUMP;
 	          }
 	
 	          /* upward tile collision */
-	          else	if ( map_checkCollision( g_Player.x + HALF_PLAYER_WIDTH, yNew ) || /* top-mid */ 
-		               map_checkCollision( g_Player.x, yNew ) || /* top-left */ 
-		               map_checkCollision( g_Player.x + PLAYER_WIDTH - 1, yNew ) )
+	          else	if ( map_checkRow( world->map, world->player.x, world->player.x + PLAYER_WIDTH - 1, yNew ) ) /* check the top edge */
 	          {
-		          yNew = ( ( yNew / TILE_HEIGHT ) + 1 ) * TILE_HEIGHT;
-		          g_Player.yVel = 0;
-		          g_Player.jump = JUMPED;
+		          yNew = ( ( (int) yNew / TILE_HEIGHT ) + 1 ) * TILE_HEIGHT;
+		          world->player.yVel = 0;
+		          world->player.jump = JUMPED;
 	          }
 	          
-	          g_Player.y = yNew;
+	          world->player.y = yNew;
 	     }
 	     /* check if the player fell off the platform */
-	     else if ( g_Player.jump == CAN_JUMP &&
-	               !map_checkCollision( g_Player.x, g_Player.y + PLAYER_HEIGHT ) &&
-	               !map_checkCollision( g_Player.x + PLAYER_WIDTH, g_Player.y + PLAYER_HEIGHT ) )
+	     else if ( world->player.jump == CAN_JUMP &&
+	               !map_checkRow( world->map, world->player.x, world->player.x + PLAYER_WIDTH, world->player.y + PLAYER_HEIGHT ) )
           {
-               g_Player.jump = JUMPED;
+               world->player.jump = JUMPED;
           }
      }
 	
-	if ( g_Player.xVel != 0 )
+	if ( world->player.xVel != 0 )
 	{	
-	     int xNew = g_Player.x + g_Player.xVel * ( deltaTicks / 1000.f );
+	     float xNew = world->player.x + world->player.xVel * ( deltaTicks / 1000.f );
 	
 	     /* leftward tile collision */
-	     if ( map_checkCollision( xNew, g_Player.y + HALF_PLAYER_HEIGHT ) || /* check mid-left, or */
-		     ( g_Player.yVel < 0 && map_checkCollision( xNew, g_Player.y + PLAYER_HEIGHT ) ) || /* if falling, check bot-left; or */
-		     ( g_Player.yVel > 0 && map_checkCollision( xNew, g_Player.y ) ) ) /* if rising, check top-left */
+	     if ( map_checkCollision( world->map, xNew, world->player.y + HALF_PLAYER_HEIGHT ) || /* check mid-left, or */
+		     ( world->player.yVel < 0 && map_checkCollision( world->map, xNew, world->player.y + PLAYER_HEIGHT ) ) || /* if falling, check bot-left; or */
+		     ( world->player.yVel > 0 && map_checkCollision( world->map, xNew, world->player.y ) ) ) /* if rising, check top-left */
 	     {
-		     xNew = ( ( xNew / TILE_WIDTH ) + 1 ) * TILE_WIDTH;
-		     g_Player.xVel = 0;
+		     xNew = ( ( (int) xNew / TILE_WIDTH ) + 1 ) * TILE_WIDTH;
+		     world->player.xVel = 0;
 	     }
 	
 	     /* rightward tile collision */
-	     else if ( map_checkCollision( xNew + PLAYER_WIDTH, g_Player.y + HALF_PLAYER_HEIGHT ) || /* check mid-right, or */
-		     ( g_Player.yVel < 0 && map_checkCollision( xNew + PLAYER_WIDTH, g_Player.y + PLAYER_HEIGHT ) ) || /* if falling, check bot-right; or */
-		     ( g_Player.yVel > 0 && map_checkCollision( xNew + PLAYER_WIDTH, g_Player.y ) ) ) /* if rising, check top-right */
+	     else if ( map_checkCollision( world->map, xNew + PLAYER_WIDTH, world->player.y + HALF_PLAYER_HEIGHT ) || /* check mid-right, or */
+		     ( world->player.yVel < 0 && map_checkCollision( world->map, xNew + PLAYER_WIDTH, world->player.y + PLAYER_HEIGHT ) ) || /* if falling, check bot-right; or */
+		     ( world->player.yVel > 0 && map_checkCollision( world->map, xNew + PLAYER_WIDTH, world->player.y ) ) ) /* if rising, check top-right */
 	     {
-		     xNew = ( xNew / TILE_WIDTH ) * TILE_WIDTH;
-		     g_Player.xVel = 0;
+		     xNew = ( (int) xNew / TILE_WIDTH ) * TILE_WIDTH;
+		     world->player.xVel = 0;
 	     }
 	     
-	     g_Player.x = xNew;
+	     world->player.x = xNew;
 	}
 	/* if player standing above end and pressed down, change map -- TODO: add a neat effect */
-	else if ( g_Player.keyPressed[DOWN] && map_getTile( ( g_Player.x + HALF_PLAYER_WIDTH ) / TILE_WIDTH, ( g_Player.y + PLAYER_HEIGHT ) / TILE_HEIGHT ) == 'E' )
+	else if ( world->player.keyPressed[DOWN] && map_getTileOf( world->map, ( world->player.x + HALF_PLAYER_WIDTH ) / TILE_WIDTH, ( world->player.y + PLAYER_HEIGHT ) / TILE_HEIGHT ) == 'E' )
 	{
-	     map_change();
-	     player_reset();
+	     map_change( world );
+	     player_reset( world );
 	     return;
      }
 	
 	/* show the proper animation */
 	
-	if ( g_Player.yVel != 0 || g_Player.jump != CAN_JUMP ) /* jump / falling animation */
-		g_Player.sprite.rect = anim_getRect( g_Player.lastDir == RIGHT ? PLAYER_JUMP_RIGHT : PLAYER_JUMP_LEFT, 0 );
-	else if ( g_Player.keyPressed[DOWN] ) /* crouch animation */
-          g_Player.sprite.rect = anim_getRect( g_Player.lastDir == RIGHT ? PLAYER_DUCK_RIGHT : PLAYER_DUCK_LEFT, 0 );
-	else if ( g_Player.keyPressed[LEFT] || g_Player.keyPressed[RIGHT] ) /* walking animation */
+	if ( world->player.yVel != 0 || world->player.jump != CAN_JUMP ) /* jump / falling animation */
+		world->player.sprite.rect = anim_getRect( world->player.lastDir == RIGHT ? PLAYER_JUMP_RIGHT : PLAYER_JUMP_LEFT, 0 );
+	else if ( world->player.keyPressed[DOWN] ) /* crouch animation */
+          world->player.sprite.rect = anim_getRect( world->player.lastDir == RIGHT ? PLAYER_DUCK_RIGHT : PLAYER_DUCK_LEFT, 0 );
+	else if ( world->player.keyPressed[LEFT] || world->player.keyPressed[RIGHT] ) /* walking animation */
 	{
-		if ( g_Player.keyPressed[LEFT] && g_Player.xVel > 0 )
-		     g_Player.sprite.rect = anim_getRect( PLAYER_TURN_LEFT, 0 );
-		else if ( g_Player.keyPressed[RIGHT] && g_Player.xVel < 0 )
-		     g_Player.sprite.rect = anim_getRect( PLAYER_TURN_RIGHT, 0 );
+		if ( world->player.keyPressed[LEFT] && world->player.xVel > 0 )
+		     world->player.sprite.rect = anim_getRect( PLAYER_TURN_LEFT, 0 );
+		else if ( world->player.keyPressed[RIGHT] && world->player.xVel < 0 )
+		     world->player.sprite.rect = anim_getRect( PLAYER_TURN_RIGHT, 0 );
 		else
-     		g_Player.sprite.rect = anim_getRect( g_Player.lastDir == RIGHT ? PLAYER_MOVE_RIGHT : PLAYER_MOVE_LEFT, g_Player.frame );
+     		world->player.sprite.rect = anim_getRect( world->player.lastDir == RIGHT ? PLAYER_MOVE_RIGHT : PLAYER_MOVE_LEFT, world->player.frame );
 		
-		if ( timer_update( &g_Player.frameTimer ) )
-			g_Player.frame = ( g_Player.frame + 1 ) % 5;
+		if ( timer_update( &world->player.frameTimer, world_getTicks( world ) ) )
+			world->player.frame = ( world->player.frame + 1 ) % 5;
 	}
 	else
-	     g_Player.sprite.rect = anim_getRect( g_Player.lastDir == RIGHT ? PLAYER_IDLE_RIGHT : PLAYER_IDLE_LEFT, 0 );
+	     world->player.sprite.rect = anim_getRect( world->player.lastDir == RIGHT ? PLAYER_IDLE_RIGHT : PLAYER_IDLE_LEFT, 0 );
 	
 	
 	/* reposition the player within the bounds of the screen */
-	if ( g_Player.x < 0 )
-		g_Player.x = 0;
-	else if ( g_Player.x + PLAYER_WIDTH > SCREEN_WIDTH )
-		g_Player.x = SCREEN_WIDTH - PLAYER_WIDTH;
+	if ( world->player.x < 0 )
+		world->player.x = 0;
+	else if ( world->player.x + PLAYER_WIDTH > world->map->width * TILE_WIDTH )
+		world->player.x = world->map->width * TILE_WIDTH - PLAYER_WIDTH;
 }
 
-void player_draw( void )
+void player_draw( Snapshot * snap, float alpha, int viewX, int viewY )
 {
-	sprite_draw( &g_Player.sprite, (int) g_Player.x, (int) g_Player.y );
+	float x = snap->playerPrevX + ( snap->playerX - snap->playerPrevX ) * alpha;
+	float y = snap->playerPrevY + ( snap->playerY - snap->playerPrevY ) * alpha;
+	
+	draw_queue( snap->player.image, &snap->player.rect, (int) x - viewX, (int) y - viewY, DRAW_LAYER_PLAYER );
 }
 
 /************************************************************/
 
-void game_handleEvent( SDL_Event * event )
+int world_reset( World * world );
+
+void world_handleEvent( World * world, SDL_Event * event )
 {
 	/* press any key is visible */
-	if ( g_Player.lives < 0 && !Mix_PlayingMusic() && event->type == SDL_KEYDOWN )
+	if ( world->player.lives < 0 && timer_getElapsedTime( &world->utilTimer, world_getTicks( world ) ) >= GAME_OVER_TIME && event->type == SDL_KEYDOWN )
 	{
-		reset();
+		world_reset( world );
 		return;
 	}
 		
 	/* do not continue if player is dead or displaying level text */
-	if ( g_Player.dead || g_displayLevelText ) return;
+	if ( world->player.dead || world->displayLevelText ) return;
 
 	if ( event->type == SDL_KEYDOWN )
 	{
 		switch ( event->key.keysym.sym )
 		{
 		     case SDLK_UP:
-				if ( g_Player.jump == CAN_JUMP )
+				if ( world->player.jump == CAN_JUMP )
 				{
-					g_Player.jump = JUMPING;
-					playSound( g_sfxJump );
+					world->player.jump = JUMPING;
+					world_playSound( world, g_sfxJump );
 				}
-				g_Player.keyPressed[UP] = 1;
+				world->player.keyPressed[UP] = 1;
 			break;
 			case SDLK_DOWN:
-				g_Player.keyPressed[DOWN] = 1;
+				world->player.keyPressed[DOWN] = 1;
 			break;
 			case SDLK_RIGHT:
-                    g_Player.frame = 1;
-                    timer_reset( &g_Player.frameTimer );
-                    g_Player.keyPressed[RIGHT] = 1;
+                    world->player.frame = 1;
+                    timer_reset( &world->player.frameTimer, world_getTicks( world ) );
+                    world->player.keyPressed[RIGHT] = 1;
 			break;
 			case SDLK_LEFT:
-				g_Player.frame = 1;
-				timer_reset( &g_Player.frameTimer );
-				g_Player.keyPressed[LEFT] = 1;
+				world->player.frame = 1;
+				timer_reset( &world->player.frameTimer, world_getTicks( world ) );
+				world->player.keyPressed[LEFT] = 1;
 			break;
 			case SDLK_z:
-				map_change(); 
+				map_change( world ); 
 			break;
 			default: break;
 		}
@@ -941,163 +2244,580 @@ void game_handleEvent( SDL_Event * event )
 		switch ( event->key.keysym.sym )
 		{
 			case SDLK_UP:
-				g_Player.keyPressed[UP] = 0;
+				world->player.keyPressed[UP] = 0;
 			break;
 			case SDLK_DOWN:
-			     g_Player.keyPressed[DOWN] = 0;
+			     world->player.keyPressed[DOWN] = 0;
 			break;
 			case SDLK_LEFT:
-			     g_Player.keyPressed[LEFT] = 0;
+			     world->player.keyPressed[LEFT] = 0;
 			break;
 			case SDLK_RIGHT:
-			     g_Player.keyPressed[RIGHT] = 0;
+			     world->player.keyPressed[RIGHT] = 0;
 			break;
 			default: break;
 		}
 	}
 }
 
-void game_update( unsigned deltaTick )
+/* remembers the positions before an update so drawing can interpolate from them */
+void game_saveState( World * world )
+{
+	MovingPlatformController * mpc = &world->map->mpc;
+	EnemyController * ec = &world->map->ec;
+	
+	world->player.prevX = world->player.x;
+	world->player.prevY = world->player.y;
+	
+	memcpy( mpc->prevX, mpc->x, sizeof( float ) * mpc->count );
+	memcpy( mpc->prevY, mpc->y, sizeof( float ) * mpc->count );
+	memcpy( ec->prevX, ec->x, sizeof( float ) * ec->count );
+	memcpy( ec->prevY, ec->y, sizeof( float ) * ec->count );
+}
+
+/* advances a world by a tick. only the main world is timed by the profiler */
+void world_update( World * world, float deltaTick )
 {
+	game_saveState( world );
+	
 	/* play the music */
-	if ( !g_Player.dead && g_Player.lives >= 0 )
+	if ( world->shown && !world->player.dead && world->player.lives >= 0 )
 	{
-		if ( !Mix_PlayingMusic() && Mix_PlayMusic( g_musBGM, -1 ) == -1 ) 
+		if ( !isMusicPlaying() && playMusic( g_musBGM, -1 ) == -1 ) 
 			fprintf( stderr, "Error playing BGM: %s\n", Mix_GetError() );
 	}
 	
-	if ( g_displayLevelText && timer_getElapsedTime( &g_utilTimer ) >= 1000 )
-		g_displayLevelText = 0;
+	if ( world->displayLevelText && timer_getElapsedTime( &world->utilTimer, world_getTicks( world ) ) >= 1000 )
+		world->displayLevelText = 0;
 	
-	if ( !g_displayLevelText )
+	if ( !world->displayLevelText )
 	{
-		int lastScore = g_Player.score;
-		int lastCoins = g_Player.coins;
-		char str[20];
-	
-	     mpc_update( deltaTick );
-		player_update( deltaTick );
-		cc_update();
+		if ( world->shown ) prof_begin( PROF_PLATFORMS );
+		mpc_update( world, deltaTick );
+		if ( world->shown ) prof_end( PROF_PLATFORMS );
+		
+		if ( world->shown ) prof_begin( PROF_PLAYER );
+		player_update( world, deltaTick );
+		if ( world->shown ) prof_end( PROF_PLAYER );
+		
+		if ( world->shown ) prof_begin( PROF_ENEMIES );
+		ec_update( world, deltaTick );
+		if ( world->shown ) prof_end( PROF_ENEMIES );
 		
-		/* update the dynamic text: coins */
-		if ( g_textCoins == NULL || lastCoins != g_Player.coins )
+		if ( world->shown ) prof_begin( PROF_COINS );
+		cc_update( world );
+		if ( world->shown ) prof_end( PROF_COINS );
+	}
+	
+	/* keep the chunks around the view resident, the player may also have been moved to the start */
+	map_stream( world->map, camera_getX( world->map->width, world->player.x ) );
+	
+	world->time += deltaTick;
+}
+
+/************************************************************/
+
+/* makes room for a number of items in an array of a snapshot, returns 1 if there isn't the memory */
+static int snapshot_reserve( void ** items, int * size, int count, size_t itemSize )
+{
+	void * grown;
+
+	if ( count <= *size )
+		return 0;
+	if ( count < *size * 2 )
+		count = *size * 2;
+
+	if ( ( grown = realloc( *items, count * itemSize ) ) == NULL )
+	{
+		fprintf( stderr, "Failed to make room for %d items in a snapshot\n", count );
+		return 1;
+	}
+
+	*items = grown;
+	*size = count;
+	return 0;
+}
+
+/* a span moved between two positions is near a range if it could have been in it on the way */
+static int snapshot_isNear( float from, float to, int size, int first, int last )
+{
+	return ( from < to ? from : to ) <= last + 1 && ( from > to ? from : to ) + size >= first - 1;
+}
+
+/* copies what can be seen of a map from the views between two into a snapshot */
+static int snapshot_takeMap( Snapshot * snap, Map * map, int viewX0, int viewY0, int viewX1, int viewY1 )
+{
+	MovingPlatformController * mpc = &map->mpc;
+	EnemyController * ec = &map->ec;
+	CoinController * cc = &map->cc;
+	int i, x, y, x0, y0, x1, y1;
+
+	snap->serial = map->serial;
+	snap->width = map->width;
+	snap->height = map->height;
+
+	/* the tiles of the cache chunks the views overlap, the static layer is composed from them */
+	snap->tileX = viewX0 / ( TILE_WIDTH * CACHE_CHUNK_TILES ) * CACHE_CHUNK_TILES;
+	snap->tileY = viewY0 / ( TILE_HEIGHT * CACHE_CHUNK_TILES ) * CACHE_CHUNK_TILES;
+	snap->tileWidth = ( viewX1 + SCREEN_WIDTH - 1 ) / ( TILE_WIDTH * CACHE_CHUNK_TILES ) * CACHE_CHUNK_TILES + CACHE_CHUNK_TILES - snap->tileX;
+	snap->tileHeight = ( viewY1 + SCREEN_HEIGHT - 1 ) / ( TILE_HEIGHT * CACHE_CHUNK_TILES ) * CACHE_CHUNK_TILES + CACHE_CHUNK_TILES - snap->tileY;
+
+	if ( snapshot_reserve( (void **) &snap->tiles, &snap->tileSize, snap->tileWidth * snap->tileHeight, sizeof( char ) ) != 0 ||
+	     snapshot_reserve( (void **) &snap->resident, &snap->residentSize, snap->tileWidth, sizeof( char ) ) != 0 ||
+	     snapshot_reserve( (void **) &snap->platforms, &snap->platformSize, mpc->count, sizeof( SnapshotSprite ) ) != 0 ||
+	     snapshot_reserve( (void **) &snap->enemies, &snap->enemySize, ec->count, sizeof( SnapshotSprite ) ) != 0 )
+		return 1;
+
+	for ( x = 0; x < snap->tileWidth; x++ )
+		snap->resident[x] = map_getChunk( map, snap->tileX + x ) != NULL;
+	for ( y = 0; y < snap->tileHeight; y++ )
+		for ( x = 0; x < snap->tileWidth; x++ )
+			snap->tiles[ y * snap->tileWidth + x ] = map_getTileOf( map, snap->tileX + x, snap->tileY + y );
+
+	/* the coins on the tiles the views overlap, in the order they're drawn */
+	x0 = viewX0 / TILE_WIDTH, x1 = ( viewX1 + SCREEN_WIDTH - 1 ) / TILE_WIDTH;
+	y0 = viewY0 / TILE_HEIGHT, y1 = ( viewY1 + SCREEN_HEIGHT - 1 ) / TILE_HEIGHT;
+	if ( x1 >= map->width ) x1 = map->width - 1;
+	if ( y1 >= map->height ) y1 = map->height - 1;
+
+	snap->coinCount = 0;
+	for ( x = x0; x <= x1; x++ )
+		for ( y = y0; y <= y1; y++ )
+			if ( bitset_test( cc->tiles, cc->height, x, y ) )
+			{
+				if ( snapshot_reserve( (void **) &snap->coinTiles, &snap->coinSize, ( snap->coinCount + 1 ) * 2, sizeof( int ) ) != 0 )
+					return 1;
+				snap->coinTiles[ snap->coinCount * 2 ] = x;
+				snap->coinTiles[ snap->coinCount * 2 + 1 ] = y;
+				snap->coinCount++;
+			}
+
+	/* the platforms and enemies that could be in one of the views, in the order they're drawn */
+	snap->platformCount = 0;
+	for ( i = 0; i < mpc->count; i++ )
+		if ( snapshot_isNear( mpc->prevX[i], mpc->x[i], TILE_WIDTH, viewX0, viewX1 + SCREEN_WIDTH ) &&
+		     snapshot_isNear( mpc->prevY[i], mpc->y[i], TILE_HEIGHT, viewY0, viewY1 + SCREEN_HEIGHT ) )
 		{
-			FreeSurface( g_textCoins );
-			sprintf( str, "Coins: %d", g_Player.coins );
-			g_textCoins = TTF_RenderText_Solid( g_fontSmall, str, (SDL_Color) { 0xFF, 0xFF, 0xFF } );
+			SnapshotSprite * platform = &snap->platforms[ snap->platformCount++ ];
+			platform->prevX = mpc->prevX[i];
+			platform->prevY = mpc->prevY[i];
+			platform->x = mpc->x[i];
+			platform->y = mpc->y[i];
 		}
 
-		/* update the dynamic text: score */
-		if ( g_textScore == NULL || lastScore != g_Player.score )
+	snap->enemyCount = 0;
+	for ( i = 0; i < ec->count; i++ )
+		if ( snapshot_isNear( ec->prevX[i], ec->x[i], ENEMY_WIDTH, viewX0, viewX1 + SCREEN_WIDTH ) &&
+		     snapshot_isNear( ec->prevY[i], ec->y[i], ENEMY_HEIGHT, viewY0, viewY1 + SCREEN_HEIGHT ) )
 		{
-			FreeSurface( g_textScore );
-			sprintf( str, "Score: %d", g_Player.score );
-			g_textScore = TTF_RenderText_Solid( g_fontSmall, str, (SDL_Color) { 0xFF, 0xFF, 0xFF } );
+			SnapshotSprite * enemy = &snap->enemies[ snap->enemyCount++ ];
+			enemy->prevX = ec->prevX[i];
+			enemy->prevY = ec->prevY[i];
+			enemy->x = ec->x[i];
+			enemy->y = ec->y[i];
 		}
-	}
+
+	return 0;
 }
 
-void game_draw( void )
+/* takes a snapshot of a world after a tick, returns 1 if there wasn't the memory for it */
+int world_snapshot( World * world, Snapshot * snap )
 {
-	int i;
-	if ( g_displayLevelText ) /* display the name of the current level */
+	Player * player = &world->player;
+	Map * map = world->map;
+
+	snap->level = world->curLevel;
+	snap->displayLevelText = world->displayLevelText;
+	snap->lives = player->lives;
+	snap->score = player->score;
+	snap->coins = player->coins;
+	snap->pressAnyKey = player->lives < 0 && timer_getElapsedTime( &world->utilTimer, world_getTicks( world ) ) >= GAME_OVER_TIME;
+	snap->playerX = player->x;
+	snap->playerY = player->y;
+	snap->playerPrevX = player->prevX;
+	snap->playerPrevY = player->prevY;
+	snap->player = player->sprite;
+
+	/* the view follows the player, so it is drawn somewhere between the views before and after the tick */
+	return snapshot_takeMap( snap, map,
+		camera_getX( map->width, player->prevX < player->x ? player->prevX : player->x ),
+		camera_getY( map->height, player->prevY < player->y ? player->prevY : player->y ),
+		camera_getX( map->width, player->prevX > player->x ? player->prevX : player->x ),
+		camera_getY( map->height, player->prevY > player->y ? player->prevY : player->y ) );
+}
+
+void snapshot_free( Snapshot * snap )
+{
+	free( snap->tiles );
+	free( snap->resident );
+	free( snap->platforms );
+	free( snap->enemies );
+	free( snap->coinTiles );
+	memset( snap, 0, sizeof( Snapshot ) );
+}
+
+/* draws a snapshot blended [0,1] between the states before and after its tick */
+void snapshot_draw( Snapshot * snap, float alpha )
+{
+	char str[20];
+	int i, viewX, viewY;
+	if ( snap->displayLevelText ) /* display the name of the current level */
 	{
+		sprintf( str, "Level %d", snap->level );
 		drawRect( rect( 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT ), 0, 0, 0, 255 );
-		drawImage( g_textLevel, NULL, ( SCREEN_WIDTH / 2 ) - ( g_textLevel->w / 2 ), ( SCREEN_HEIGHT / 2 ) - ( g_textLevel->h / 2 ) );
+		drawText( &g_atlasLarge, str, ( SCREEN_WIDTH / 2 ) - ( text_getWidth( &g_atlasLarge, str ) / 2 ), ( SCREEN_HEIGHT / 2 ) - ( g_atlasLarge.height / 2 ) );
 	}
-	else if ( g_Player.lives >= 0 ) /* draw the game as normal */
+	else if ( snap->lives >= 0 ) /* draw the game as normal */
 	{
-		drawImage( g_imgBG, NULL, 0, 0 );	
-	
-		map_draw(); 		/* draw the map */
-		mpc_draw();		/* draw the moving platforms */
-		cc_draw();		/* draw the coins */
-		player_draw();		/* draw the player */
+		/* the view follows the player as drawn */
+		viewX = camera_getX( snap->width, snap->playerPrevX + ( snap->playerX - snap->playerPrevX ) * alpha );
+		viewY = camera_getY( snap->height, snap->playerPrevY + ( snap->playerY - snap->playerPrevY ) * alpha );
+		
+		map_draw( snap, viewX, viewY ); 			/* draw the background and the map */
+		mpc_draw( snap, alpha, viewX, viewY );		/* draw the moving platforms */
+		ec_draw( snap, alpha, viewX, viewY );		/* draw the enemies */
+		cc_draw( snap, viewX, viewY );			/* draw the coins */
+		player_draw( snap, alpha, viewX, viewY );	/* draw the player */
+		draw_flush();								/* the above are only queued until now */
+		
+		prof_begin( PROF_HUD );
 			
 		/* draw the number of lives */
-		drawImage( g_textLives, NULL, 5, 5 );
-		for ( i = 0; i < g_Player.lives + 1; i++ )
+		drawText( &g_atlasSmall, "Lives:", 5, 5 );
+		for ( i = 0; i < snap->lives + 1; i++ )
 			drawImage( g_imgLives, NULL, i * ( g_imgLives->w + 2 ) + 5, 15 );
 
 		/* draw the player's score count */
-		drawImage( g_textScore, NULL, SCREEN_WIDTH - 95, 5 );
+		sprintf( str, "Score: %d", snap->score );
+		drawText( &g_atlasSmall, str, SCREEN_WIDTH - 95, 5 );
 		
 		/* draw the player's coin count */
-		drawImage( g_textCoins, NULL, SCREEN_WIDTH - 95, 15 );
+		sprintf( str, "Coins: %d", snap->coins );
+		drawText( &g_atlasSmall, str, SCREEN_WIDTH - 95, 15 );
+		
+		prof_end( PROF_HUD );
 	}
 	else /* player ran out of lives */
 	{
 		drawRect( rect( 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT ), 0, 0, 0, 255 );
 		drawImage( g_imgGameOver, NULL, ( SCREEN_WIDTH / 2 ) - ( g_imgGameOver->w / 2 ), ( SCREEN_HEIGHT / 2 ) - ( g_imgGameOver->h / 2 ) );
 		
-		if ( !Mix_PlayingMusic() )
+		if ( snap->pressAnyKey )
 			drawImage( g_textPressAnyKey, NULL, ( SCREEN_WIDTH / 2 ) - ( g_textPressAnyKey->w / 2 ), ( SCREEN_HEIGHT / 2 ) - ( g_textPressAnyKey->h / 2 ) + 30 );
 	}
 }
 
+/* the main world is driven by the main loop */
+
+void game_handleEvent( SDL_Event * event )
+{
+	world_handleEvent( &g_World, event );
+}
+
+void game_update( float deltaTick )
+{
+	world_update( &g_World, deltaTick );
+}
+
+void game_draw( float alpha )
+{
+	/* the ticks run on this thread too, so the snapshot is taken right before it's drawn */
+	if ( world_snapshot( &g_World, &g_snapshots[0] ) == 0 )
+		snapshot_draw( &g_snapshots[0], alpha );
+}
+
+/* with a simulation thread, the snapshots are taken on it and handed over to be drawn */
+
+int game_takeSnapshot( int buffer )
+{
+	return world_snapshot( &g_World, &g_snapshots[ buffer ] );
+}
+
+void game_drawSnapshot( int buffer, float alpha )
+{
+	snapshot_draw( &g_snapshots[ buffer ], alpha );
+}
+
 /************************************************************/
 
-int reset( void )
+/* starts a world over from the first level */
+int world_reset( World * world )
 {
-	player_init();
+	player_init( world );
 	
 	/* load first level */
-	if ( map_load( "levels/level1" ) != 0 )
+	if ( map_load( world, 1 ) != 0 )
 		return -1;
 		
-	g_curLevel = 1;
-	FreeSurface( g_textScore );
-	FreeSurface( g_textCoins );
+	world->curLevel = 1;
+	if ( world->shown )
+		replay_levelChanged( world->curLevel );
 		
 	return 0;
 }
 
+World * world_create( void )
+{
+	World * world = (World *) calloc( 1, sizeof( World ) );
+	if ( world == NULL )
+		return NULL;
+	
+	world->displayLevelText = 1;
+	if ( world_reset( world ) != 0 )
+	{
+		world_destroy( world );
+		return NULL;
+	}
+	
+	return world;
+}
+
+void world_destroy( World * world )
+{
+	if ( world == NULL ) return;
+	
+	map_cleanup( world->map );
+	arena_free( &world->mapArenas[0] );
+	arena_free( &world->mapArenas[1] );
+	free( world );
+}
+
+void world_setInput( World * world, WorldInputFn input, void * data )
+{
+	world->input = input;
+	world->inputData = data;
+}
+
+void world_getStatus( World * world, WorldStatus * status )
+{
+	status->level = world->curLevel;
+	status->lives = world->player.lives;
+	status->score = world->player.score;
+	status->coins = world->player.coins;
+	status->dead = world->player.dead;
+	status->x = world->player.x;
+	status->y = world->player.y;
+	status->ticks = world_getTicks( world );
+}
+
 /************************************************************/
 
-int game_init()
+/*
+	stepping many worlds -- every world is a job of its own on the worker pool, so the
+	workers that got the worlds that are quick to step steal the rest. worlds share
+	nothing that changes, so they need no locking.
+*/
+typedef struct WorldJob
+{
+	World * world;
+	float deltaTick;
+	int ticks;
+} WorldJob;
+
+static void world_stepJob( void * data, int worker )
 {
-	/* load images */
-	if ( ( g_imgTileset	= loadImage( "images/tiles.bmp" ) ) 	== NULL ||
-		( g_imgPlayer 	= loadImage( "images/player.bmp" ) ) 	== NULL ||
-		( g_imgEnemy 	= loadImage( "images/enemy.bmp" ) )	== NULL ||
-		( g_imgBG 	= loadImage( "images/bg.bmp" ) ) 		== NULL ||
-		( g_imgLives 	= loadImage( "images/lives.bmp" ) )	== NULL )
+	WorldJob * job = (WorldJob *) data;
+	World * world = job->world;
+	int i;
+	
+	for ( i = 0; i < job->ticks; i++ )
 	{
-		return -1;
+		if ( world->input != NULL )
+			world->input( world, world->inputData );
+		world_update( world, job->deltaTick );
+	}
+}
+
+/* steps every world by a number of ticks on the worker pool, the main world can't be one of them */
+int world_stepAll( World ** worlds, int count, float deltaTick, int ticks )
+{
+	WorldJob * jobs = (WorldJob *) malloc( sizeof( WorldJob ) * ( count + 1 ) );
+	int i;
+	
+	if ( jobs == NULL )
+	{
+		fprintf( stderr, "Failed to step %d worlds: out of memory\n", count );
+		return 1;
 	}
 	
-	/* load sound */
-	if ( ( g_sfxCoin	= loadSound( "audio/sfx-coin.wav" ) )	== NULL ||
-		( g_sfxJump	= loadSound( "audio/sfx-jump.wav" ) ) 	== NULL ||
-		( g_sfxStomp	= loadSound( "audio/sfx-stomp.wav" ) )	== NULL ||
-		( g_sfx1Up	= loadSound( "audio/sfx-1up.wav" ) )	== NULL ||
-		( g_musBGM	= loadMusic( "audio/mus-bgm.ogg" ) )	== NULL ||
-		( g_musDeath	= loadMusic( "audio/mus-death.wav" ) ) 	== NULL ||
-		( g_musGameOver = loadMusic( "audio/mus-gameover.wav" ) ) == NULL )
+	for ( i = 0; i < count; i++ )
 	{
-		return -1;
+		jobs[i].world = worlds[i];
+		jobs[i].deltaTick = deltaTick;
+		jobs[i].ticks = ticks;
+		pool_submit( world_stepJob, &jobs[i] );
+	}
+	pool_wait();
+	
+	free( jobs );
+	return 0;
+}
+
+/************************************************************/
+
+void game_printSummary( void )
+{
+	World * world = &g_World;
+	
+	fprintf( stdout, "Level %d, lives %d, score %d, coins %d, player at (%.2f, %.2f)%s\n", 
+		world->curLevel, world->player.lives, world->player.score, world->player.coins, world->player.x, world->player.y, world->player.dead ? ", dead" : "" );
+}
+
+/************************************************************/
+
+/*
+	assets are decoded by a few workers at once. only the conversion of the images to
+	the display format needs the video surface, so that and the static text are done
+	on the main thread once the workers are done. every asset is traced so the one
+	that holds up startup can be found.
+*/
+
+static const int ASSET_WORKERS			= 4;
+
+typedef enum AssetType
+{
+	ASSET_IMAGE,
+	ASSET_SOUND,
+	ASSET_MUSIC,
+	ASSET_FONTS
+} AssetType;
+
+typedef struct Asset
+{
+	AssetType type;			/* how to load the asset */
+	char * filename;			/* file to load */
+	void ** out;				/* where the asset goes once it's loaded */
+	void * loaded;				/* asset as loaded by the worker */
+	int worker;				/* worker that loaded it */
+	double start, end;			/* when it was loaded, in ms since loading started */
+} Asset;
+
+static double g_assetStart;
+
+static void asset_load( void * data, int worker )
+{
+	Asset * asset = (Asset *) data;
+	
+	asset->worker = worker;
+	asset->start = time_getMillis() - g_assetStart;
+	
+	switch ( asset->type )
+	{
+		case ASSET_IMAGE:	asset->loaded = SDL_LoadBMP_RW( pak_openFile( asset->filename ), 1 ); break;
+		case ASSET_SOUND:	asset->loaded = loadSound( asset->filename ); break;
+		case ASSET_MUSIC:	asset->loaded = loadMusic( asset->filename ); break;
+		case ASSET_FONTS:
+			/* FreeType can't open faces concurrently, so both sizes are opened by one job */
+			g_fontSmall = loadFont( asset->filename, 9 );
+			g_fontLarge = loadFont( asset->filename, 16 );
+			asset->loaded = g_fontSmall != NULL && g_fontLarge != NULL ? g_fontSmall : NULL;
+		break;
+	}
+	
+	asset->end = time_getMillis() - g_assetStart;
+}
+
+int game_loadResources( void )
+{
+	Asset assets[] = 
+	{
+		{ ASSET_IMAGE, "images/tiles.bmp", 		(void **) &g_imgTileset },
+		{ ASSET_IMAGE, "images/player.bmp", 	(void **) &g_imgPlayer },
+		{ ASSET_IMAGE, "images/enemy.bmp", 		(void **) &g_imgEnemy },
+		{ ASSET_IMAGE, "images/bg.bmp", 		(void **) &g_imgBG },
+		{ ASSET_IMAGE, "images/lives.bmp", 		(void **) &g_imgLives },
+		{ ASSET_SOUND, "audio/sfx-coin.wav", 	(void **) &g_sfxCoin },
+		{ ASSET_SOUND, "audio/sfx-jump.wav", 	(void **) &g_sfxJump },
+		{ ASSET_SOUND, "audio/sfx-stomp.wav", 	(void **) &g_sfxStomp },
+		{ ASSET_SOUND, "audio/sfx-1up.wav", 	(void **) &g_sfx1Up },
+		{ ASSET_MUSIC, "audio/mus-bgm.ogg", 	(void **) &g_musBGM },
+		{ ASSET_MUSIC, "audio/mus-death.wav", 	(void **) &g_musDeath },
+		{ ASSET_MUSIC, "audio/mus-gameover.wav", (void **) &g_musGameOver },
+		{ ASSET_FONTS, "images/font.ttf", 		NULL }
+	};
+	const int count = sizeof( assets ) / sizeof( assets[0] );
+	int i, workers, failed = 0, slowest = 0;
+	
+	g_assetStart = time_getMillis();
+	
+	/* without workers the assets are loaded one after another */
+	if ( pool_start( ASSET_WORKERS ) != 0 )
+		fprintf( stderr, "Loading assets without workers\n" );
+	workers = pool_getWorkerCount();
+	
+	/* the fonts and the music take longest, so they are queued first */
+	for ( i = count - 1; i >= 0; i-- )
+		pool_submit( asset_load, &assets[i] );
+	pool_wait();
+	pool_stop();
+	
+	double decoded = time_getMillis() - g_assetStart;
+	
+	/* finish the assets on the main thread */
+	for ( i = 0; i < count; i++ )
+	{
+		if ( assets[i].type == ASSET_IMAGE )
+			assets[i].loaded = optimizeImage( (SDL_Surface *) assets[i].loaded, assets[i].filename );
+		if ( assets[i].out != NULL )
+			*assets[i].out = assets[i].loaded;
+		
+		failed = failed || assets[i].loaded == NULL;
+		if ( assets[i].end - assets[i].start > assets[slowest].end - assets[slowest].start )
+			slowest = i;
 	}
 	
-	/* load font / static text */
+	/* build the glyph atlases and the static text */
 	SDL_Color color = { 0xFF, 0xFF, 0xFF };
-	if ( ( g_fontSmall		= loadFont( "images/font.ttf", 9 ) ) == NULL ||
-		( g_fontLarge	 	= loadFont( "images/font.ttf", 16 ) ) == NULL ||
-		( g_textLives		= TTF_RenderText_Solid( g_fontSmall, "Lives:", color ) ) == NULL ||
+	if ( failed ||
+		atlas_create( &g_atlasSmall, g_fontSmall, color ) != 0 ||
+		atlas_create( &g_atlasLarge, g_fontLarge, color ) != 0 ||
 		( g_imgGameOver 	= TTF_RenderText_Solid( g_fontLarge, "GAME OVER", color ) ) == NULL ||
 		( g_textPressAnyKey = TTF_RenderText_Solid( g_fontLarge, "Press ANY key to continue", color ) ) == NULL )
 	{
 		return -1;
-	}	
+	}
+	prof_setAtlas( &g_atlasSmall );
+	
+	/* the background covers the whole view, so it's blitted without a color key */
+	SDL_SetColorKey( g_imgBG, 0, 0 );
+	
+	/* the tiles, coins and characters are drawn many times a frame, the rest can go through SDL */
+	blit_addMask( g_imgTileset );
+	blit_addMask( g_imgPlayer );
+	blit_addMask( g_imgEnemy );
+	
+	for ( i = 0; i < count; i++ )
+		fprintf( stdout, "  %-24s worker %d  %7.2f - %7.2f ms\n", assets[i].filename, assets[i].worker, assets[i].start, assets[i].end );
+	fprintf( stdout, "Loaded assets in %.2f ms with %d workers: decoding %.2f ms, slowest %s %.2f ms, main thread %.2f ms\n",
+		time_getMillis() - g_assetStart, workers, decoded,
+		assets[slowest].filename, assets[slowest].end - assets[slowest].start, time_getMillis() - g_assetStart - decoded );
+	
+	return 0;
+}
+
+int game_init()
+{
+	/* headless runs have no use for images, sound or text */
+	if ( !g_Headless && game_loadResources() != 0 )
+		return -1;
+	
+	if ( map_startLoader() != 0 )
+		return -1;
 	
-	g_textLevel = TTF_RenderText_Solid( g_fontLarge, "Level 1", (SDL_Color) { 0xFF, 0xFF, 0xFF } );
-	g_displayLevelText = 1;
-	timer_reset( &g_utilTimer );
+	g_World.shown = 1;
+	g_World.displayLevelText = 1;
+	timer_reset( &g_World.utilTimer, world_getTicks( &g_World ) );
 	
 	return 0;
 }
 
 void game_cleanup( void )
 {
+	int i;
+	
+	map_stopLoader();
+	
+	blit_freeMasks();
 	FreeSurface( g_imgTileset );
 	FreeSurface( g_imgPlayer );
 	FreeSurface( g_imgEnemy );
@@ -1109,10 +2829,8 @@ void game_cleanup( void )
 	FreeFont( g_fontSmall );
 	FreeFont( g_fontLarge );
 	
-	FreeSurface( g_textLives );
-	FreeSurface( g_textScore );
-	FreeSurface( g_textCoins );
-	FreeSurface( g_textLevel );
+	atlas_free( &g_atlasSmall );
+	atlas_free( &g_atlasLarge );
 	FreeSurface( g_textPressAnyKey );
 	
 	FreeChunk( g_sfxCoin );
@@ -1124,19 +2842,31 @@ void game_cleanup( void )
 	FreeMusic( g_musDeath );
 	FreeMusic( g_musGameOver );
 	
-	map_cleanup( g_Map );
-	free( g_Map );
-	g_Map = NULL;
+	if ( g_World.map != NULL )
+		map_printStats( g_World.map );
+	map_cleanup( g_World.map );
+	g_World.map = NULL;
+	
+	cache_printStats();
+	cache_flush( 0 );
+	FreeSurface( g_staticLayer );
+	for ( i = 0; i < SNAPSHOT_BUFFERS; i++ )
+		snapshot_free( &g_snapshots[i] );
+	
+	arena_free( &g_World.mapArenas[0] );
+	arena_free( &g_World.mapArenas[1] );
 }
 
 int game_setState( void )
 {	
-	if ( reset() == -1 )
+	if ( world_reset( &g_World ) == -1 )
 		return -1;
 	
 	g_handleEventsFn 	= &game_handleEvent;
 	g_updateFn 		= &game_update;
 	g_drawFn 			= &game_draw;
+	g_snapshotFn		= &game_takeSnapshot;
+	g_drawSnapshotFn		= &game_drawSnapshot;
 	
 	return 0;
 }
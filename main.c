@@ -1,26 +1,75 @@
+#define _POSIX_C_SOURCE 199309L
+
 #include "main.h"
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 const int SCREEN_WIDTH 				= 640;
 const int SCREEN_HEIGHT 				= 480;
 const int SCREEN_BPP 				= 32;
 
-static const int FRAMES_PER_SECOND 	= 60;
+static const int MAX_TICKS_PER_FRAME	= 5; /* catch-up limit after a slow frame */
 
 void ( *g_handleEventsFn )( SDL_Event * ) 	= NULL;
-void ( *g_updateFn )( unsigned )		 	= NULL;
-void ( *g_drawFn )( void )			 	= NULL;
+void ( *g_updateFn )( float )		 	= NULL;
+void ( *g_drawFn )( float )			 	= NULL;
+int ( *g_snapshotFn )( int )				= NULL;
+void ( *g_drawSnapshotFn )( int, float )		= NULL;
 
 int g_Running							= 1;
+int g_Headless							= 0;
 
 static SDL_Surface * g_Screen 			= NULL;
-static char g_WinCaption[30];
+
+/* dirty rectangles -- the areas drawn to in this and the last frame, only those are presented */
+#define MAX_DIRTY_RECTS 128
+
+typedef struct DirtyList
+{
+	SDL_Rect rects[ MAX_DIRTY_RECTS ];
+	int count;
+	int area;					/* total area, overlaps are counted twice */
+	int full;						/* the whole screen has to be presented */
+	int overflow;					/* ran out of space, the list is incomplete */
+} DirtyList;
+
+static DirtyList g_dirty[2];
+static DirtyList * g_curDirty			= &g_dirty[0];
+static DirtyList * g_lastDirty			= &g_dirty[1];
+
+static SDL_Surface * g_background		= NULL;	/* background drawn in the last frame */
+static int g_drewBackground				= 0;
+static char g_WinCaption[128];
+
+static long g_maxFrames					= 0; /* headless: stop after this many frames, 0 to run forever */
+static int g_frameRate					= 60; /* frames per second, 0 for uncapped */
+static int g_tickRate					= 120; /* simulation ticks per second */
+static float g_stepTime					= 0; /* length of a tick in milliseconds */
+
+static long g_chunkCacheKB				= 4096; /* memory for pre-rendered map chunks */
+static int g_renderThreads				= 1; /* threads that draw the frames, each a band of the screen */
+static int g_simThreaded				= 0; /* the ticks run on a thread of their own */
+
+static char * g_recordFile				= NULL;
+static char * g_replayFile				= NULL;
+
+/* simulation clock -- only advanced by ticks so the game never sees wall-clock time */
+static double g_simTime					= 0;
+static unsigned g_simStep				= 0;
 
 /************************************************************/
 
 SDL_Surface * loadImage( char * filename )
 {
-	SDL_Surface * image = SDL_LoadBMP( filename );
+	return optimizeImage( SDL_LoadBMP_RW( pak_openFile( filename ), 1 ), filename );
+}
+
+/* converts a loaded image to the display format, has to run on the main thread */
+SDL_Surface * optimizeImage( SDL_Surface * image, char * filename )
+{
 	SDL_Surface * optimized = NULL;
 	
 	if ( image != NULL )
@@ -43,7 +92,7 @@ SDL_Surface * loadImage( char * filename )
 
 TTF_Font * loadFont( char * filename, int ptsize )
 {
-	TTF_Font * font = TTF_OpenFont( filename, ptsize );
+	TTF_Font * font = TTF_OpenFontRW( pak_openFile( filename ), 1, ptsize );
 	
 	int loaded = font != NULL;
 	fprintf( loaded ? stdout : stderr, "%s: %s\n", loaded ? "Loaded font" : TTF_GetError(), filename );
@@ -53,7 +102,7 @@ TTF_Font * loadFont( char * filename, int ptsize )
 
 Mix_Chunk * loadSound( char * filename )
 {
-	Mix_Chunk * sfx = Mix_LoadWAV( filename );
+	Mix_Chunk * sfx = Mix_LoadWAV_RW( pak_openFile( filename ), 1 );
 	
 	int loaded = sfx != NULL;
 	fprintf( loaded ? stdout : stderr, "%s: %s\n", loaded ? "Loaded sound" : SDL_GetError(), filename );
@@ -63,7 +112,8 @@ Mix_Chunk * loadSound( char * filename )
 
 Mix_Music * loadMusic( char * filename )
 {
-	Mix_Music * mus = Mix_LoadMUS( filename );
+	/* music is streamed from the file while it plays, so the stream has to stay open */
+	Mix_Music * mus = Mix_LoadMUS_RW( pak_openStream( filename ) );
 	
 	int loaded = mus != NULL;
 	fprintf( loaded ? stdout : stderr, "%s: %s\n", loaded ? "Loaded music" : SDL_GetError(), filename );
@@ -73,23 +123,533 @@ Mix_Music * loadMusic( char * filename )
 
 /************************************************************/
 
-void drawImage( SDL_Surface * source, SDL_Rect * subrect, int x, int y )
+static void markDirty( SDL_Rect * rect )
+{
+	DirtyList * dirty = g_curDirty;
+	
+	if ( rect->w == 0 || rect->h == 0 || dirty->overflow ) return;
+	
+	if ( dirty->count == MAX_DIRTY_RECTS )
+	{
+		dirty->overflow = 1;
+		return;
+	}
+	
+	dirty->rects[ dirty->count++ ] = *rect;
+	dirty->area += rect->w * rect->h;
+	
+	/* when most of the screen changed, copying all of it is cheaper than many small copies */
+	if ( dirty->area >= SCREEN_WIDTH * SCREEN_HEIGHT / 2 )
+		dirty->full = 1;
+}
+
+void screen_invalidate( void )
+{
+	g_curDirty->full = 1;
+	g_background = NULL;
+}
+
+/* presents the dirty areas of the screen, or all of it when too much changed */
+static void presentScreen( void )
+{
+	SDL_Rect rects[ MAX_DIRTY_RECTS * 2 ];
+	
+	if ( g_curDirty->full || g_curDirty->overflow )
+		SDL_Flip( g_Screen );
+	else
+	{
+		/* the last frame's areas are presented again since they were erased */
+		memcpy( rects, g_lastDirty->rects, sizeof( SDL_Rect ) * g_lastDirty->count );
+		memcpy( rects + g_lastDirty->count, g_curDirty->rects, sizeof( SDL_Rect ) * g_curDirty->count );
+		SDL_UpdateRects( g_Screen, g_lastDirty->count + g_curDirty->count, rects );
+	}
+	
+	/* without a background to restore from, the next frame starts from scratch */
+	if ( !g_drewBackground )
+		g_background = NULL;
+	g_drewBackground = 0;
+	
+	DirtyList * swap = g_lastDirty;
+	g_lastDirty = g_curDirty;
+	g_curDirty = swap;
+	g_curDirty->count = 0;
+	g_curDirty->area = 0;
+	g_curDirty->full = 0;
+	g_curDirty->overflow = 0;
+}
+
+static int render_bands( SDL_Surface * background );
+
+void drawBackground( SDL_Surface * background )
+{
+	SDL_Rect rect;
+	int i;
+	
+	g_drewBackground = 1;
+	
+	/* a different background, or an unknown last frame, has to be drawn in full */
+	if ( background != g_background || g_lastDirty->overflow )
+	{
+		g_background = background;
+		if ( !render_bands( background ) )
+			SDL_BlitSurface( background, NULL, g_Screen, NULL );
+		g_curDirty->full = 1;
+		return;
+	}
+	
+	/* otherwise only erase what was drawn over it in the last frame */
+	for ( i = 0; i < g_lastDirty->count; i++ )
+	{
+		rect = g_lastDirty->rects[i];
+		SDL_BlitSurface( background, &g_lastDirty->rects[i], g_Screen, &rect );
+	}
+}
+
+/*
+	masked blits -- the images drawn the most get an opacity mask when they're loaded,
+	a word per pixel that is all ones where the pixel isn't the color key. a blit of
+	one of them is clipped here and copied through the mask by a vectorized kernel,
+	which skips the setup SDL does for every blit. an image must not change once its
+	mask is made.
+*/
+#define MAX_BLIT_MASKS 8
+
+typedef struct BlitMask
+{
+	SDL_Surface * image;
+	Uint32 * mask;				/* same size and pitch as the image */
+} BlitMask;
+
+static BlitMask g_blitMasks[ MAX_BLIT_MASKS ];
+static int g_blitMaskCount				= 0;
+
+/* makes the opacity mask of an image, returns 1 if the image has to be blitted by SDL */
+int blit_addMask( SDL_Surface * image )
+{
+	SDL_PixelFormat * format;
+	BlitMask * blit;
+	int x, y;
+	
+	if ( image == NULL || g_Screen == NULL || g_blitMaskCount == MAX_BLIT_MASKS )
+		return 1;
+	
+	/* only color-keyed images in the format of the screen */
+	format = image->format;
+	if ( format->BytesPerPixel != 4 || g_Screen->format->BytesPerPixel != 4 ||
+	     format->Rmask != g_Screen->format->Rmask || format->Gmask != g_Screen->format->Gmask ||
+	     format->Bmask != g_Screen->format->Bmask || format->Amask != 0 ||
+	     ( image->flags & ( SDL_SRCCOLORKEY | SDL_SRCALPHA ) ) != SDL_SRCCOLORKEY || image->pitch % 4 != 0 )
+		return 1;
+	
+	blit = &g_blitMasks[ g_blitMaskCount ];
+	if ( ( blit->mask = (Uint32 *) malloc( image->pitch * image->h ) ) == NULL )
+	{
+		fprintf( stderr, "Failed to allocate the blit mask of a %dx%d image\n", image->w, image->h );
+		return 1;
+	}
+	
+	SDL_LockSurface( image );
+	for ( y = 0; y < image->h; y++ )
+	{
+		Uint32 * row = (Uint32 *) ( (Uint8 *) image->pixels + y * image->pitch );
+		for ( x = 0; x < image->w; x++ )
+			blit->mask[ y * image->pitch / 4 + x ] = row[x] != format->colorkey ? 0xFFFFFFFF : 0;
+	}
+	SDL_UnlockSurface( image );
+	
+	blit->image = image;
+	g_blitMaskCount++;
+	return 0;
+}
+
+void blit_freeMasks( void )
+{
+	while ( g_blitMaskCount > 0 )
+		free( g_blitMasks[ --g_blitMaskCount ].mask );
+}
+
+static BlitMask * blit_findMask( SDL_Surface * image )
+{
+	int i;
+	for ( i = 0; i < g_blitMaskCount; i++ )
+		if ( g_blitMasks[i].image == image )
+			return &g_blitMasks[i];
+	return NULL;
+}
+
+/*
+	clips a blit like SDL_BlitSurface does, rect becomes the area drawn to and the
+	source position is returned in sx and sy. returns 0 if nothing is drawn.
+*/
+static int blit_clip( SDL_Surface * source, SDL_Rect * subrect, SDL_Rect * clip, SDL_Rect * rect, int * sx, int * sy )
+{
+	int w, h, dx = rect->x, dy = rect->y;
+	
+	if ( subrect != NULL )
+		*sx = subrect->x, *sy = subrect->y, w = subrect->w, h = subrect->h;
+	else
+		*sx = *sy = 0, w = source->w, h = source->h;
+	
+	/* clip to the image, then to the screen */
+	if ( *sx < 0 ) { w += *sx; dx -= *sx; *sx = 0; }
+	if ( *sy < 0 ) { h += *sy; dy -= *sy; *sy = 0; }
+	if ( *sx + w > source->w ) w = source->w - *sx;
+	if ( *sy + h > source->h ) h = source->h - *sy;
+	
+	if ( dx < clip->x ) { w -= clip->x - dx; *sx += clip->x - dx; dx = clip->x; }
+	if ( dy < clip->y ) { h -= clip->y - dy; *sy += clip->y - dy; dy = clip->y; }
+	if ( dx + w > clip->x + clip->w ) w = clip->x + clip->w - dx;
+	if ( dy + h > clip->y + clip->h ) h = clip->y + clip->h - dy;
+	
+	if ( w <= 0 || h <= 0 )
+	{
+		rect->w = rect->h = 0;
+		return 0;
+	}
+	
+	rect->x = dx;
+	rect->y = dy;
+	rect->w = w;
+	rect->h = h;
+	return 1;
+}
+
+/* blits an image through its mask within a clip rect, returns 0 if it has none */
+static int blitMasked( BlitMask * blit, SDL_Surface * source, SDL_Rect * subrect, SDL_Rect * rect, SDL_Rect * clip )
+{
+	int sx, sy;
+	
+	if ( blit == NULL || SDL_MUSTLOCK( g_Screen ) )
+		return 0;
+	
+	if ( blit_clip( source, subrect, clip, rect, &sx, &sy ) )
+		simd_blitMasked( (Uint32 *) ( (Uint8 *) g_Screen->pixels + rect->y * g_Screen->pitch ) + rect->x, g_Screen->pitch / 4,
+			(Uint32 *) ( (Uint8 *) source->pixels + sy * source->pitch ) + sx, blit->mask + sy * source->pitch / 4 + sx,
+			source->pitch / 4, rect->w, rect->h );
+	return 1;
+}
+
+static void blitImage( BlitMask * blit, SDL_Surface * source, SDL_Rect * subrect, int x, int y )
 {
 	SDL_Rect rect;
 	rect.x = x;
 	rect.y = y;
 	
-	SDL_BlitSurface( source, subrect, g_Screen, &rect );
+	if ( !blitMasked( blit, source, subrect, &rect, &g_Screen->clip_rect ) )
+		SDL_BlitSurface( source, subrect, g_Screen, &rect );
+	markDirty( &rect );
+}
+
+void drawImage( SDL_Surface * source, SDL_Rect * subrect, int x, int y )
+{
+	blitImage( blit_findMask( source ), source, subrect, x, y );
+}
+
+/************************************************************/
+
+/*
+	draw commands -- the sprites of a frame are queued instead of drawn right away,
+	then sorted by layer, image and row and drawn in one pass, so the blits of an
+	image follow each other down the screen. the commands of a layer can be drawn in
+	any order, they may only overlap where that doesn't change the picture. sprites
+	that can overlap get layers of their own, so the platforms stay under the coins.
+*/
+#define MAX_DRAW_COMMANDS 4096
+
+typedef struct DrawCommand
+{
+	SDL_Surface * source;
+	BlitMask * blit;				/* mask of the source, found when the queue is drawn */
+	SDL_Rect subrect;
+	int whole;					/* the whole image is drawn and subrect isn't used */
+	int x, y;
+	int layer;
+	int order;					/* place in the queue, ties are drawn in it */
+} DrawCommand;
+
+static DrawCommand g_drawCommands[ MAX_DRAW_COMMANDS ];
+static int g_drawCommandCount			= 0;
+
+void draw_queue( SDL_Surface * source, SDL_Rect * subrect, int x, int y, int layer )
+{
+	DrawCommand * command;
+	
+	/* a full queue is drawn early, what's queued after it is drawn over it anyway */
+	if ( g_drawCommandCount == MAX_DRAW_COMMANDS )
+		draw_flush();
+	
+	command = &g_drawCommands[ g_drawCommandCount ];
+	command->source = source;
+	command->whole = subrect == NULL;
+	if ( subrect != NULL )
+		command->subrect = *subrect;
+	command->x = x;
+	command->y = y;
+	command->layer = layer;
+	command->order = g_drawCommandCount++;
+}
+
+static int compareCommands( const void * a, const void * b )
+{
+	const DrawCommand * x = (const DrawCommand *) a, * y = (const DrawCommand *) b;
+	
+	if ( x->layer != y->layer )
+		return x->layer < y->layer ? -1 : 1;
+	if ( x->source != y->source )
+		return (size_t) x->source < (size_t) y->source ? -1 : 1;
+	if ( x->y != y->y )
+		return x->y < y->y ? -1 : 1;
+	return x->order - y->order;
+}
+
+/************************************************************/
+
+/*
+	banded rendering -- with more than one render thread, the sprites and full
+	background copies are drawn by the worker pool, one horizontal band of the screen
+	per worker. each band goes through all the commands and clips them to its rows,
+	so the workers never write the same pixels and the picture is the same as when
+	drawn by one thread. SDL's own blits aren't safe to run at once, so a queue with
+	an image that has no mask is drawn by the main thread.
+*/
+typedef struct RenderBand
+{
+	SDL_Rect clip;					/* rows of the screen the band draws */
+	SDL_Surface * background;			/* background to copy, or NULL to draw the commands */
+} RenderBand;
+
+static int g_renderBandCount			= 1;
+
+/* sets the number of bands, the pool has to be running with as many workers */
+void render_setBands( int bands )
+{
+	g_renderBandCount = bands < 1 ? 1 : bands;
+}
+
+static void render_band( void * data, int worker )
+{
+	RenderBand * band = (RenderBand *) data;
+	SDL_Rect rect;
+	int i;
+	
+	if ( band->background != NULL )
+	{
+		for ( i = band->clip.y; i < band->clip.y + band->clip.h; i++ )
+			memcpy( (Uint8 *) g_Screen->pixels + i * g_Screen->pitch + band->clip.x * 4,
+				(Uint8 *) band->background->pixels + i * band->background->pitch + band->clip.x * 4, band->clip.w * 4 );
+		return;
+	}
+	
+	for ( i = 0; i < g_drawCommandCount; i++ )
+	{
+		DrawCommand * command = &g_drawCommands[i];
+		rect.x = command->x;
+		rect.y = command->y;
+		blitMasked( command->blit, command->source, command->whole ? NULL : &command->subrect, &rect, &band->clip );
+	}
+}
+
+/* draws the commands or copies a background a band at a time, returns 0 if it has to be done by one thread */
+static int render_bands( SDL_Surface * background )
+{
+	RenderBand bands[ 64 ];
+	SDL_Rect * clip = &g_Screen->clip_rect;
+	int i, count = g_renderBandCount < 64 ? g_renderBandCount : 64;
+	
+	if ( count < 2 || pool_getWorkerCount() < 2 || SDL_MUSTLOCK( g_Screen ) )
+		return 0;
+	
+	if ( background != NULL )
+	{
+		/* a copy is only a memcpy of the rows when nothing has to be converted or keyed */
+		if ( background->w != g_Screen->w || background->h != g_Screen->h || background->format->BytesPerPixel != 4 ||
+		     g_Screen->format->BytesPerPixel != 4 || background->format->Rmask != g_Screen->format->Rmask ||
+		     background->format->Gmask != g_Screen->format->Gmask || background->format->Bmask != g_Screen->format->Bmask ||
+		     ( background->flags & ( SDL_SRCCOLORKEY | SDL_SRCALPHA ) ) || SDL_MUSTLOCK( background ) )
+			return 0;
+	}
+	else
+		for ( i = 0; i < g_drawCommandCount; i++ )
+			if ( g_drawCommands[i].blit == NULL )
+				return 0;
+	
+	for ( i = 0; i < count; i++ )
+	{
+		int top = clip->y + clip->h * i / count, bottom = clip->y + clip->h * ( i + 1 ) / count;
+		bands[i].clip = rect( clip->x, top, clip->w, bottom - top );
+		bands[i].background = background;
+		pool_submit( render_band, &bands[i] );
+	}
+	pool_wait();
+	
+	return 1;
+}
+
+void draw_flush( void )
+{
+	SDL_Surface * source = NULL;
+	BlitMask * blit = NULL;
+	SDL_Rect rect;
+	int i, sx, sy;
+	
+	qsort( g_drawCommands, g_drawCommandCount, sizeof( DrawCommand ), compareCommands );
+	
+	/* the mask is looked up once for each run of an image */
+	for ( i = 0; i < g_drawCommandCount; i++ )
+	{
+		if ( g_drawCommands[i].source != source )
+			blit = blit_findMask( source = g_drawCommands[i].source );
+		g_drawCommands[i].blit = blit;
+	}
+	
+	if ( render_bands( NULL ) )
+	{
+		/* the bands are joined, mark what they drew as a whole */
+		for ( i = 0; i < g_drawCommandCount; i++ )
+		{
+			DrawCommand * command = &g_drawCommands[i];
+			rect.x = command->x;
+			rect.y = command->y;
+			blit_clip( command->source, command->whole ? NULL : &command->subrect, &g_Screen->clip_rect, &rect, &sx, &sy );
+			markDirty( &rect );
+		}
+	}
+	else
+		for ( i = 0; i < g_drawCommandCount; i++ )
+		{
+			DrawCommand * command = &g_drawCommands[i];
+			blitImage( command->blit, command->source, command->whole ? NULL : &command->subrect, command->x, command->y );
+		}
+	
+	g_drawCommandCount = 0;
+}
+
+/************************************************************/
+
+/* renders the printable ASCII characters of a font into one surface, one cell per character */
+int atlas_create( GlyphAtlas * atlas, TTF_Font * font, SDL_Color color )
+{
+	SDL_Surface * cells[GLYPH_COUNT];
+	char str[2] = { 0, 0 };
+	int i, width = 0;
+	
+	memset( atlas, 0, sizeof( GlyphAtlas ) );
+	atlas->height = TTF_FontHeight( font );
+	
+	for ( i = 0; i < GLYPH_COUNT; i++ )
+	{
+		int advance = 0;
+		str[0] = GLYPH_FIRST + i;
+		
+		/* whole-text rendering keeps every cell on the same baseline */
+		cells[i] = TTF_RenderText_Solid( font, str, color );
+		TTF_GlyphMetrics( font, str[0], NULL, NULL, NULL, NULL, &advance );
+		
+		atlas->glyphs[i].x = width;
+		atlas->glyphs[i].w = cells[i] != NULL ? cells[i]->w : 0;
+		atlas->glyphs[i].h = cells[i] != NULL ? cells[i]->h : 0;
+		atlas->advance[i] = advance;
+		width += atlas->glyphs[i].w;
+	}
+	
+	SDL_Surface * surface = SDL_CreateRGBSurface( SDL_SWSURFACE, width, atlas->height, 32, 0, 0, 0, 0 );
+	if ( surface != NULL )
+	{
+		SDL_FillRect( surface, NULL, SDL_MapRGB( surface->format, 0xFF, 0x00, 0xFF ) );
+		for ( i = 0; i < GLYPH_COUNT; i++ )
+			if ( cells[i] != NULL )
+				SDL_BlitSurface( cells[i], NULL, surface, &atlas->glyphs[i] );
+		
+		atlas->surface = SDL_DisplayFormat( surface );
+		SDL_FreeSurface( surface );
+	}
+	
+	for ( i = 0; i < GLYPH_COUNT; i++ )
+		SDL_FreeSurface( cells[i] );
+	
+	if ( atlas->surface == NULL )
+	{
+		fprintf( stderr, "Failed to create glyph atlas: %s\n", SDL_GetError() );
+		return 1;
+	}
+	
+	SDL_SetColorKey( atlas->surface, SDL_SRCCOLORKEY, SDL_MapRGB( atlas->surface->format, 0xFF, 0x00, 0xFF ) );
+	
+	return 0;
+}
+
+void atlas_free( GlyphAtlas * atlas )
+{
+	FreeSurface( atlas->surface );
+}
+
+int text_getWidth( GlyphAtlas * atlas, const char * text )
+{
+	int width = 0;
+	for ( ; *text != '\0'; text++ )
+		if ( *text >= GLYPH_FIRST && *text < GLYPH_FIRST + GLYPH_COUNT )
+			width += atlas->advance[ *text - GLYPH_FIRST ];
+	return width;
+}
+
+/* draws text from the cells of an atlas, the whole text is one dirty rect */
+void drawText( GlyphAtlas * atlas, const char * text, int x, int y )
+{
+	SDL_Rect dst, dirty;
+	const char * c;
+	int right = x;
+	
+	dirty.x = x;
+	dirty.y = y;
+	
+	for ( c = text; *c != '\0'; c++ )
+	{
+		if ( *c < GLYPH_FIRST || *c >= GLYPH_FIRST + GLYPH_COUNT )
+			continue;
+		
+		SDL_Rect * glyph = &atlas->glyphs[ *c - GLYPH_FIRST ];
+		dst.x = x;
+		dst.y = y;
+		SDL_BlitSurface( atlas->surface, glyph, g_Screen, &dst );
+		
+		if ( x + glyph->w > right )
+			right = x + glyph->w;
+		x += atlas->advance[ *c - GLYPH_FIRST ];
+	}
+	
+	/* the blits are clipped to the screen, so the dirty rect has to be too */
+	int left = dirty.x < 0 ? 0 : dirty.x, top = dirty.y < 0 ? 0 : dirty.y;
+	int bottom = dirty.y + atlas->height;
+	if ( right > SCREEN_WIDTH ) right = SCREEN_WIDTH;
+	if ( bottom > SCREEN_HEIGHT ) bottom = SCREEN_HEIGHT;
+	
+	if ( right > left && bottom > top )
+	{
+		dirty = rect( left, top, right - left, bottom - top );
+		markDirty( &dirty );
+	}
 }
 
 void drawRect( SDL_Rect rect, char r, char g, char b, char a )
 {
 	SDL_FillRect( g_Screen, &rect, SDL_MapRGBA( g_Screen->format, r, g, b, a ) );
+	markDirty( &rect );
 }
 
 void playSound( Mix_Chunk * sfx )
 {
-	Mix_PlayChannel( -1, sfx, 0 );
+	if ( !g_Headless )
+		Mix_PlayChannel( -1, sfx, 0 );
+}
+
+int playMusic( Mix_Music * mus, int loops )
+{
+	return g_Headless ? 0 : Mix_PlayMusic( mus, loops );
+}
+
+int isMusicPlaying( void )
+{
+	return g_Headless ? 0 : Mix_PlayingMusic();
 }
 
 /************************************************************/
@@ -123,30 +683,73 @@ void sprite_draw( Sprite * sprite, int x, int y )
 
 /************************************************************/
 
-int timer_getElapsedTime( Timer * timer )
+double time_getMillis( void )
 {
-	return SDL_GetTicks() - timer->tick;
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
 }
 
-int timer_update( Timer * timer )
+Uint64 time_getNanos( void )
 {
-	if ( timer->tick + timer->interval < SDL_GetTicks() )
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (Uint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/************************************************************/
+
+unsigned sim_getTicks( void )
+{
+	return (unsigned) g_simTime;
+}
+
+unsigned sim_getStep( void )
+{
+	return g_simStep;
+}
+
+/************************************************************/
+
+int timer_getElapsedTime( Timer * timer, unsigned now )
+{
+	return now - timer->tick;
+}
+
+int timer_update( Timer * timer, unsigned now )
+{
+	if ( timer->tick + timer->interval < now )
 	{
-		timer->tick = SDL_GetTicks();
+		timer->tick = now;
 		return 1;
 	}
 	return 0;
 }
 
-void timer_reset( Timer * timer )
+void timer_reset( Timer * timer, unsigned now )
 {
-	timer->tick = SDL_GetTicks();
+	timer->tick = now;
 }
 
 /************************************************************/
 
 int init( void )
 {
+	/* headless runs only need the timer, everything else is skipped */
+	if ( g_Headless )
+	{
+		if ( SDL_Init( SDL_INIT_TIMER ) == -1 )
+		{
+			fprintf( stderr, "Failed to initialize SDL: %s\n", SDL_GetError() );
+			return 1;
+		}
+		
+		if ( game_init() != 0 || game_setState() != 0 )
+			return 1;
+		
+		return 0;
+	}
+
 	if ( SDL_Init( SDL_INIT_EVERYTHING ) == -1 )
 	{
 		fprintf( stderr, "Failed to initialize SDL: %s\n", SDL_GetError() );
@@ -165,6 +768,9 @@ int init( void )
 		return -1;
 	}
 	
+	/* the loaders fall back to the loose files when there's no archive */
+	pak_open( "assets.pak" );
+	
 	/* create the screen */	
 	g_Screen = SDL_SetVideoMode( SCREEN_WIDTH, SCREEN_HEIGHT, SCREEN_BPP, SDL_SWSURFACE );
 	
@@ -176,8 +782,19 @@ int init( void )
 	
 	if ( game_init() != 0 || game_setState() != 0 )
 		return 1;
+	
+	/* the frames are profiled on this thread */
+	prof_init();
+	
+	/* the pool is free once the assets are loaded, the render threads are its workers */
+	if ( g_renderThreads > 1 )
+	{
+		if ( pool_start( g_renderThreads ) != 0 )
+			return 1;
+		render_setBands( g_renderThreads );
+	}
 		
-	sprintf( g_WinCaption, "Mario Tangent -- %d FPS", FRAMES_PER_SECOND );
+	sprintf( g_WinCaption, "Mario Tangent -- %d FPS", g_frameRate );
 	SDL_WM_SetCaption( g_WinCaption, NULL );
 	
 	return 0;
@@ -185,77 +802,512 @@ int init( void )
 
 void clean_up( void )
 {
+	render_setBands( 1 );
+	pool_stop();
+	replay_stop();
+	prof_cleanup();
 	game_cleanup();	
+	pak_close();
 	SDL_Quit();
 }
 
 /************************************************************/
 
+void stop( int sig )
+{
+	g_Running = 0;
+}
+
+int parseArgs( int argc, char ** argv )
+{
+	size_t limit;
+	int i;
+	for ( i = 1; i < argc; i++ )
+	{
+		if ( strcmp( argv[i], "--headless" ) == 0 )
+			g_Headless = 1;
+		else if ( strcmp( argv[i], "--frames" ) == 0 && i + 1 < argc )
+			g_maxFrames = atol( argv[++i] );
+		else if ( strcmp( argv[i], "--fps" ) == 0 && i + 1 < argc )
+			g_frameRate = atoi( argv[++i] );
+		else if ( strcmp( argv[i], "--tickrate" ) == 0 && i + 1 < argc )
+			g_tickRate = atoi( argv[++i] );
+		else if ( strcmp( argv[i], "--record" ) == 0 && i + 1 < argc )
+			g_recordFile = argv[++i];
+		else if ( strcmp( argv[i], "--replay" ) == 0 && i + 1 < argc )
+			g_replayFile = argv[++i];
+		else if ( strcmp( argv[i], "--chunk-cache" ) == 0 && i + 1 < argc )
+			g_chunkCacheKB = atol( argv[++i] );
+		else if ( strcmp( argv[i], "--render-threads" ) == 0 && i + 1 < argc )
+			g_renderThreads = atoi( argv[++i] );
+		else if ( strcmp( argv[i], "--sim-thread" ) == 0 )
+			g_simThreaded = 1;
+		else
+		{
+			fprintf( stderr, "Usage: %s [--headless] [--frames N] [--fps N] [--tickrate HZ] [--record FILE | --replay FILE] [--chunk-cache KB] [--render-threads N] [--sim-thread]\n", argv[0] );
+			return 1;
+		}
+	}
+	
+	if ( g_frameRate < 0 )
+	{
+		fprintf( stderr, "Invalid frame rate: %d\n", g_frameRate );
+		return 1;
+	}
+	
+	if ( g_tickRate <= 0 || g_tickRate > REPLAY_MAX_TICK_RATE )
+	{
+		fprintf( stderr, "Invalid tick rate: %d\n", g_tickRate );
+		return 1;
+	}
+	
+	if ( g_recordFile != NULL && ( g_replayFile != NULL || g_Headless ) )
+	{
+		fprintf( stderr, "Recording needs a window and can't be combined with a replay\n" );
+		return 1;
+	}
+	
+	if ( g_chunkCacheKB < 0 )
+	{
+		fprintf( stderr, "Invalid chunk cache size: %ld KB\n", g_chunkCacheKB );
+		return 1;
+	}
+	if ( ( limit = map_setCacheLimit( (size_t) g_chunkCacheKB * 1024 ) ) < (size_t) g_chunkCacheKB * 1024 )
+	{
+		g_chunkCacheKB = (long) ( limit / 1024 );
+		fprintf( stderr, "Chunk cache limited to %ld KB, the most its entries can hold\n", g_chunkCacheKB );
+	}
+	
+	if ( g_renderThreads < 1 || g_renderThreads > 64 )
+	{
+		fprintf( stderr, "Invalid number of render threads: %d\n", g_renderThreads );
+		return 1;
+	}
+	
+	return 0;
+}
+
+/* advances the simulation by one fixed tick */
+void sim_tick( void )
+{
+	SDL_Event event;
+	
+	/* feed the recorded input that is due before this tick */
+	while ( replay_nextEvent( &event ) )
+		(*g_handleEventsFn)( &event );
+	
+	(*g_updateFn)( g_stepTime );
+	
+	g_simTime += g_stepTime;
+	g_simStep++;
+}
+
+void finishReplay( void )
+{
+	fprintf( stdout, "Replay finished after %u ticks\n", g_simStep );
+	game_printSummary();
+}
+
+/************************************************************/
+
+/*
+	simulation thread -- the ticks run on a thread of their own, paced by the wall clock,
+	while the main thread polls the events and draws. the input is handed to the ticks
+	through a queue, and the state is handed back as snapshots through a triple buffer:
+	the simulation fills its back buffer and swaps it with the ready one, and the main
+	thread swaps its front buffer with the ready one when that is newer. the swaps are
+	atomic, so neither thread ever waits for the other.
+*/
+#define SIM_EVENT_QUEUE 256
+#define SNAPSHOT_FRESH 4		/* set on the ready buffer until it's taken */
+
+static SDL_Thread * g_simThread			= NULL;
+static int g_simQuit					= 0;	/* set and read with atomics, like the snapshot slot */
+static int g_simFinished				= 0;	/* the replay ran out */
+static double g_simDue					= 0;	/* when the next tick is due, in milliseconds */
+
+static SDL_mutex * g_eventLock			= NULL;	/* guards the queued events */
+static SDL_Event g_events[ SIM_EVENT_QUEUE ];
+static int g_eventCount					= 0;
+
+static int g_snapshotBack				= 0;	/* simulation thread only */
+static int g_snapshotFront				= 1;	/* main thread only */
+static int g_snapshotReady				= 2;	/* buffer in between, and SNAPSHOT_FRESH */
+static double g_snapshotDue[ SNAPSHOT_BUFFERS ];	/* when the tick of each buffer was due */
+
+/* puts a buffer in the ready slot, returns the one that was there */
+static int snapshot_exchange( int buffer )
+{
+	int ready;
+	do
+		ready = __sync_fetch_and_add( &g_snapshotReady, 0 );
+	while ( !__sync_bool_compare_and_swap( &g_snapshotReady, ready, buffer ) );
+	return ready;
+}
+
+/* hands a snapshot of the state after the tick that was due at a time over to the main thread */
+static void sim_publish( double due )
+{
+	if ( (*g_snapshotFn)( g_snapshotBack ) != 0 )
+		return;
+	
+	g_snapshotDue[ g_snapshotBack ] = due;
+	g_snapshotBack = snapshot_exchange( g_snapshotBack | SNAPSHOT_FRESH ) & ~SNAPSHOT_FRESH;
+}
+
+/* queues an event for the ticks, the main thread's side of sim_handleEvents */
+static void sim_queueEvent( SDL_Event * event )
+{
+	SDL_LockMutex( g_eventLock );
+	if ( g_eventCount < SIM_EVENT_QUEUE )
+		g_events[ g_eventCount++ ] = *event;
+	else
+		fprintf( stderr, "Dropped an event, the simulation is too far behind\n" );
+	SDL_UnlockMutex( g_eventLock );
+}
+
+/* handles the events queued since the last tick, they are recorded as input of the next */
+static void sim_handleEvents( void )
+{
+	SDL_Event events[ SIM_EVENT_QUEUE ];
+	int count, i;
+	
+	SDL_LockMutex( g_eventLock );
+	count = g_eventCount;
+	memcpy( events, g_events, count * sizeof( SDL_Event ) );
+	g_eventCount = 0;
+	SDL_UnlockMutex( g_eventLock );
+	
+	for ( i = 0; i < count; i++ )
+	{
+		replay_recordEvent( &events[i] );
+		(*g_handleEventsFn)( &events[i] );
+	}
+}
+
+static void sim_sleepUntil( double due )
+{
+	double wait = due - time_getMillis();
+	struct timespec ts;
+	
+	if ( wait <= 0 )
+		return;
+	
+	ts.tv_sec = (time_t) ( wait / 1000 );
+	ts.tv_nsec = (long) ( ( wait - ts.tv_sec * 1000.0 ) * 1000000 );
+	nanosleep( &ts, NULL );
+}
+
+static int sim_run( void * data )
+{
+	int ticks;
+	
+	while ( !__sync_fetch_and_add( &g_simQuit, 0 ) )
+	{
+		sim_handleEvents();
+		
+		if ( replay_isPlaying() ) /* replays run as fast as possible */
+		{
+			if ( replay_isFinished() )
+			{
+				__sync_lock_test_and_set( &g_simFinished, 1 );
+				break;
+			}
+			
+			sim_tick();
+			sim_publish( time_getMillis() );
+			continue;
+		}
+		
+		/* the same fixed timestep as the main loop's, on a clock of its own */
+		double now = time_getMillis(), due = 0;
+		for ( ticks = 0; now >= g_simDue && ticks < MAX_TICKS_PER_FRAME; ticks++ )
+		{
+			sim_tick();
+			due = g_simDue;
+			g_simDue += g_stepTime;
+		}
+		
+		/* too far behind, drop the backlog instead of spiraling */
+		if ( now >= g_simDue )
+		{
+			due = now;
+			g_simDue = now + g_stepTime;
+		}
+		
+		if ( ticks > 0 )
+			sim_publish( due );
+		
+		sim_sleepUntil( g_simDue );
+	}
+	
+	return 0;
+}
+
+int sim_start( void )
+{
+	if ( ( g_eventLock = SDL_CreateMutex() ) == NULL )
+	{
+		fprintf( stderr, "Failed to create the event queue: %s\n", SDL_GetError() );
+		return 1;
+	}
+	
+	/* the first frame is drawn before the first tick, which is due a step from now */
+	if ( (*g_snapshotFn)( g_snapshotFront ) != 0 )
+		return 1;
+	g_simDue = g_snapshotDue[ g_snapshotFront ] = time_getMillis();
+	g_simDue += g_stepTime;
+	
+	if ( ( g_simThread = SDL_CreateThread( sim_run, NULL ) ) == NULL )
+	{
+		fprintf( stderr, "Failed to start the simulation thread: %s\n", SDL_GetError() );
+		return 1;
+	}
+	
+	return 0;
+}
+
+void sim_stop( void )
+{
+	if ( g_simThread != NULL )
+	{
+		__sync_lock_test_and_set( &g_simQuit, 1 );
+		SDL_WaitThread( g_simThread, NULL );
+		g_simThread = NULL;
+	}
+	
+	if ( g_eventLock != NULL )
+	{
+		SDL_DestroyMutex( g_eventLock );
+		g_eventLock = NULL;
+	}
+}
+
+/* draws the newest snapshot, blended by the time since its tick was due */
+void sim_draw( void )
+{
+	float alpha = 1;
+	
+	if ( __sync_fetch_and_add( &g_snapshotReady, 0 ) & SNAPSHOT_FRESH )
+		g_snapshotFront = snapshot_exchange( g_snapshotFront ) & ~SNAPSHOT_FRESH;
+	
+	/* replays are drawn without blending, like when they run on the main thread */
+	if ( !replay_isPlaying() )
+	{
+		alpha = ( time_getMillis() - g_snapshotDue[ g_snapshotFront ] ) / g_stepTime;
+		if ( alpha > 1 ) alpha = 1;
+		if ( alpha < 0 ) alpha = 0;
+	}
+	
+	(*g_drawSnapshotFn)( g_snapshotFront, alpha );
+}
+
+/* runs the simulation without a window as fast as possible */
+int runHeadless( void )
+{
+	long frames = 0;
+	int fps = 0;
+	unsigned start = SDL_GetTicks(), nextReport = start + 1000;
+	
+	signal( SIGINT, stop );
+	
+	while ( g_Running && ( g_maxFrames == 0 || frames < g_maxFrames ) )
+	{
+		if ( replay_isFinished() )
+		{
+			finishReplay();
+			break;
+		}
+		
+		/* every frame is one fixed simulation tick */
+		sim_tick();
+		frames++;
+		fps++;
+		
+		if ( SDL_GetTicks() >= nextReport )
+		{
+			fprintf( stdout, "Simulated %d frames/s\n", fps );
+			nextReport += 1000;
+			fps = 0;
+		}
+	}
+	
+	unsigned elapsed = SDL_GetTicks() - start;
+	fprintf( stdout, "Simulated %ld frames in %u ms (%.0f frames/s)\n", frames, elapsed, 
+		elapsed > 0 ? frames * 1000.0 / elapsed : 0.0 );
+	
+	clean_up();
+	
+	return 0;
+}
+
+/* the benchmarks provide their own main */
+#ifndef NO_MAIN
+
 int main( int argc, char ** argv )
 {
 	int errc = 0;
+	if ( ( errc = parseArgs( argc, argv ) ) != 0 )
+		return errc;
+	
+	/* replays are only deterministic at the tick rate they were recorded with */
+	if ( g_replayFile != NULL && replay_startPlayback( g_replayFile, &g_tickRate ) != 0 )
+		return 1;
+	if ( g_recordFile != NULL && replay_startRecording( g_recordFile, g_tickRate ) != 0 )
+		return 1;
+	
+	g_stepTime = 1000.0f / g_tickRate;
+	
 	if ( ( errc = init() ) != 0 )
 		return errc;
+	
+	if ( g_Headless )
+		return runHeadless();
 		
-	int nextTick = 0, interval = 1 * 1000 / FRAMES_PER_SECOND;
+	/* frame pacing, replays aren't paced */
+	pacer_init( replay_isPlaying() ? 0 : g_frameRate );
 	
 	/* fps counter */
-	int fps = FRAMES_PER_SECOND;
-	Timer FPStimer;
-	FPStimer.tick = 0;
-	FPStimer.interval = 1000;
+	int fps = 0;
+	int nextReport = SDL_GetTicks() + 1000;
+	
+	/* fixed timestep -- the simulation always advances in steps of the same length,
+	   the time left over in the accumulator is used to interpolate the drawing */
+	float accumulator = 0;
+	int lastTime = SDL_GetTicks(), ticks;
 	
-	/* delta timer -- used for frame-independent movement */
-	Timer delta;
-	delta.tick = 0;
+	/* time spent drawing, averaged per frame in the caption */
+	double drawStart, drawTime = 0;
 	
 	/* cycle functions */
 	void ( *handleEventsFn )( SDL_Event* ) 	= g_handleEventsFn;
-	void ( *updateFn )( unsigned ) 		= g_updateFn;
-	void ( *drawFn )( void ) 			= g_drawFn;
+	void ( *drawFn )( float ) 			= g_drawFn;
 		
 	SDL_Event event;
+	
+	/* the ticks and the drawing overlap, the ticks are only seen through the snapshots from here on */
+	if ( g_simThreaded && sim_start() != 0 )
+	{
+		sim_stop();
+		clean_up();
+		return 1;
+	}
 		
 	while ( g_Running )
 	{
+		prof_begin( PROF_EVENTS );
 		while ( SDL_PollEvent( &event ) )
 		{
 			if ( event.type == SDL_QUIT )
 				g_Running = 0;
+			else if ( event.type == SDL_KEYDOWN && prof_handleKey( event.key.keysym.sym ) )
+				continue; /* the profiler keys aren't game input, they're neither handled nor recorded */
+			else if ( replay_isPlaying() ) /* live input is ignored during a replay */
+				continue;
+			else if ( g_simThreaded )
+				sim_queueEvent( &event );
 			else
+			{
+				replay_recordEvent( &event );
 				(*handleEventsFn)( &event );
+			}
+		}
+		prof_end( PROF_EVENTS );
+		
+		int tick = SDL_GetTicks() - lastTime;
+		lastTime += tick;
+		
+		if ( g_simThreaded ) /* the newest state is drawn whatever the ticks are doing */
+		{
+			if ( __sync_fetch_and_add( &g_simFinished, 0 ) )
+				break;
+			
+			prof_begin( PROF_DRAW );
+			drawStart = time_getMillis();
+			sim_draw();
+			drawTime += time_getMillis() - drawStart;
+			prof_end( PROF_DRAW );
+		}
+		else if ( replay_isPlaying() ) /* replays run one tick per frame, as fast as possible */
+		{
+			if ( replay_isFinished() )
+			{
+				finishReplay();
+				break;
+			}
+			
+			prof_begin( PROF_UPDATE );
+			sim_tick();
+			prof_end( PROF_UPDATE );
+			
+			prof_begin( PROF_DRAW );
+			drawStart = time_getMillis();
+			(*drawFn)( 1 );
+			drawTime += time_getMillis() - drawStart;
+			prof_end( PROF_DRAW );
 		}
+		else
+		{
+			accumulator += tick;
 		
-		int tick = timer_getElapsedTime( &delta );
-		(*updateFn)( tick );
-		timer_reset( &delta );
+			prof_begin( PROF_UPDATE );
+			for ( ticks = 0; accumulator >= g_stepTime && ticks < MAX_TICKS_PER_FRAME; ticks++ )
+			{
+				sim_tick();
+				accumulator -= g_stepTime;
+			}
+			
+			/* too far behind, drop the backlog instead of spiraling */
+			if ( accumulator >= g_stepTime )
+				accumulator = 0;
+			prof_end( PROF_UPDATE );
+			
+			prof_begin( PROF_DRAW );
+			drawStart = time_getMillis();
+			(*drawFn)( accumulator / g_stepTime );
+			drawTime += time_getMillis() - drawStart;
+			prof_end( PROF_DRAW );
+		}
 		
-		(*drawFn)();
+		/* the overlay isn't part of any phase */
+		prof_drawOverlay();
 		
 		/* update the screen */
-		SDL_Flip( g_Screen );
+		prof_begin( PROF_PRESENT );
+		presentScreen();
+		prof_end( PROF_PRESENT );
+		prof_endFrame();
 		
 		/* frame rate control */
-		if ( nextTick > SDL_GetTicks() )
-			SDL_Delay( nextTick - SDL_GetTicks() );
-		nextTick = SDL_GetTicks() + interval;
+		pacer_wait();
 		fps++;
 		
 		/* if 1 second passed, update the frame rate counter */
-		if ( timer_update( &FPStimer ) )
+		if ( SDL_GetTicks() >= nextReport )
 		{
-			sprintf( g_WinCaption, "Mario Tangent -- %d FPS (%d)", fps, tick );
+			PacerStats stats = pacer_takeStats();
+			sprintf( g_WinCaption, "Mario Tangent -- %d FPS (%.2f ms, jitter %.3f ms) draw %.2f ms", 
+				fps, pacer_getMean( &stats ), pacer_getJitter( &stats ), fps > 0 ? drawTime / fps : 0.0 );
 			SDL_WM_SetCaption( g_WinCaption, NULL );
+			drawTime = 0;
+			nextReport += 1000;
 			fps = 0;
 		}
 		
 		/* update cycle functions */
 		handleEventsFn = g_handleEventsFn;
-		updateFn 		= g_updateFn;
 		drawFn 		= g_drawFn;
 	}
 	
+	/* a replay on the simulation thread is only done once the thread is */
+	sim_stop();
+	if ( __sync_fetch_and_add( &g_simFinished, 0 ) )
+		finishReplay();
+	
+	pacer_printStats();
 	clean_up();
 	
 	return errc;
 }
+
+#endif
@@ -12,10 +12,12 @@ extern const int SCREEN_HEIGHT;
 extern const int SCREEN_BPP;
 
 extern int g_Running;
+extern int g_Headless;			/* no window or audio, only the simulation runs */
 
 /* SDL resource functions */
 
 SDL_Surface * loadImage( char * filename );
+SDL_Surface * optimizeImage( SDL_Surface * image, char * filename );
 TTF_Font * loadFont( char * filename, int ptsize );
 Mix_Chunk * loadSound( char * filename );
 Mix_Music * loadMusic( char * filename );
@@ -26,8 +28,21 @@ Mix_Music * loadMusic( char * filename );
 #define FreeMusic(s) Mix_FreeMusic(s);s=NULL
 
 void drawRect( SDL_Rect rect, char r, char g, char b, char a );
+void drawBackground( SDL_Surface * background );
 void drawImage( SDL_Surface * source, SDL_Rect * subrect, int x, int y );
+int blit_addMask( SDL_Surface * image );	/* drawImage blits the image through a precomputed opacity mask */
+void blit_freeMasks( void );
+
+/* queued blits, drawn layer by layer by draw_flush and sorted by image and row within a layer */
+enum { DRAW_LAYER_PLATFORMS, DRAW_LAYER_COINS, DRAW_LAYER_ENEMIES, DRAW_LAYER_PLAYER };
+
+void draw_queue( SDL_Surface * source, SDL_Rect * subrect, int x, int y, int layer );
+void draw_flush( void );
+void render_setBands( int bands );	/* draws with the worker pool, a band of the screen per worker */
+void screen_invalidate( void );
 void playSound( Mix_Chunk * sfx );
+int playMusic( Mix_Music * mus, int loops );
+int isMusicPlaying( void );
 
 /* SDL_Rect utility functions */
 SDL_Rect rect( int x, int y, unsigned w, unsigned h );
@@ -36,8 +51,14 @@ int rect_intersect( SDL_Rect a, SDL_Rect b );
 
 /* functions that are called every cycle -- to change state, change the function pointer */
 extern void ( *g_handleEventsFn )( SDL_Event * );
-extern void ( *g_updateFn )( unsigned );
-extern void ( *g_drawFn )( void );
+extern void ( *g_updateFn )( float );	/* advances the state by a fixed number of milliseconds */
+extern void ( *g_drawFn )( float );		/* draws the state blended [0,1] between the last two updates */
+
+/* with a simulation thread the state is drawn from snapshots, which are handed over through a triple buffer */
+#define SNAPSHOT_BUFFERS 3
+
+extern int ( *g_snapshotFn )( int );			/* copies what is drawn of the state into a buffer, 0 on success */
+extern void ( *g_drawSnapshotFn )( int, float );	/* draws a buffer blended [0,1] between the two updates it holds */
 
 /* sprite utility struct and functions */
 typedef struct Sprite
@@ -48,20 +69,150 @@ typedef struct Sprite
 
 void sprite_draw( Sprite * sprite, int x, int y );
 
-/* timer utility struct and functions */
+/* glyph atlas, the printable ASCII characters of a font rendered once */
+#define GLYPH_FIRST 32
+#define GLYPH_COUNT 95
+
+typedef struct GlyphAtlas
+{
+	SDL_Surface * surface;			/* cells of all the characters */
+	SDL_Rect glyphs[GLYPH_COUNT];		/* cell of each character */
+	int advance[GLYPH_COUNT];		/* distance to the next character */
+	int height;					/* height of the cells */
+} GlyphAtlas;
+
+int atlas_create( GlyphAtlas * atlas, TTF_Font * font, SDL_Color color );
+void atlas_free( GlyphAtlas * atlas );
+int text_getWidth( GlyphAtlas * atlas, const char * text );
+void drawText( GlyphAtlas * atlas, const char * text, int x, int y );
+
+/* monotonic wall-clock time with sub-millisecond precision, for measurements only */
+double time_getMillis( void );
+Uint64 time_getNanos( void );
+
+/* frame pacing, see pacer.c. intervals are in milliseconds */
+typedef struct PacerStats
+{
+	long frames;			/* number of frames */
+	double sum, sumSquares;	/* sum of the intervals and of their squares */
+	double min, max;		/* shortest and longest interval */
+} PacerStats;
+
+void pacer_init( int fps );
+void pacer_wait( void );
+PacerStats pacer_takeStats( void );
+PacerStats pacer_getTotalStats( void );
+double pacer_getMean( PacerStats * stats );
+double pacer_getJitter( PacerStats * stats );
+void pacer_printStats( void );
+
+/* frame profiler, see profiler.c. the top level phases come first */
+typedef enum ProfPhase
+{
+	PROF_EVENTS, PROF_UPDATE, PROF_DRAW, PROF_PRESENT, PROF_TOP_PHASES,
+	PROF_PLATFORMS = PROF_TOP_PHASES, PROF_PLAYER, PROF_ENEMIES, PROF_COINS, PROF_HUD, PROF_PHASES
+} ProfPhase;
+
+void prof_init( void );	/* only the phases of the calling thread are recorded */
+void prof_begin( ProfPhase phase );
+void prof_end( ProfPhase phase );
+void prof_endFrame( void );
+int prof_dump( char * filename );
+int prof_handleKey( SDLKey key );
+void prof_setAtlas( GlyphAtlas * atlas );
+void prof_drawOverlay( void );
+void prof_cleanup( void );
+
+/* simulation clock of the main loop -- advanced by every tick */
+unsigned sim_getTicks( void );
+unsigned sim_getStep( void );
+
+/* timer utility struct and functions, the time is in milliseconds of the clock the timer runs on */
 typedef struct Timer
 {
 	int tick;			/* time to change frame */
 	int interval;		/* interval to change frame */
 } Timer;
 
-int timer_getElapsedTime( Timer * timer );
-int timer_update( Timer * timer );
-void timer_reset( Timer * timer );
+int timer_getElapsedTime( Timer * timer, unsigned now );
+int timer_update( Timer * timer, unsigned now );
+void timer_reset( Timer * timer, unsigned now );
+
+/* arena allocator, memory is freed all at once by a reset */
+typedef struct Arena
+{
+	char * base;		/* memory block */
+	size_t size;		/* size of the block */
+	size_t used;		/* bytes handed out since the last reset */
+	size_t peak;		/* most bytes used since the last reset */
+} Arena;
+
+int arena_init( Arena * arena, size_t size );
+void arena_free( Arena * arena );
+void * arena_alloc( Arena * arena, size_t size );
+void arena_reset( Arena * arena );
+
+/* asset archive, see pak.c */
+int pak_open( char * filename );
+void pak_close( void );
+SDL_RWops * pak_openFile( char * filename );
+SDL_RWops * pak_openStream( char * filename );
+
+/* work-stealing worker pool, see pool.c. jobs get the index of the worker that runs them */
+typedef void ( *JobFn )( void * data, int worker );
+
+int pool_start( int workers );
+void pool_stop( void );
+int pool_getWorkerCount( void );
+int pool_getCoreCount( void );
+void pool_submit( JobFn fn, void * data );
+void pool_wait( void );
+
+/* vectorized kernels, see simd.c */
+enum { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2 };
+
+int simd_getLevel( void );
+int simd_setLevel( int level );
+const char * simd_getLevelName( int level );
+void simd_addScaled( float * dst, const float * src, float scale, int count );
+void simd_blitMasked( Uint32 * dst, int dstPitch, const Uint32 * src, const Uint32 * mask, int srcPitch, int width, int height );
+
+/* input recording and playback */
+#define REPLAY_MAX_TICK_RATE 65535		/* the tick rate is stored in 16 bits */
+
+int replay_startRecording( char * filename, int tickRate );
+int replay_startPlayback( char * filename, int * tickRate );
+void replay_stop( void );
+int replay_isPlaying( void );
+int replay_isFinished( void );
+void replay_recordEvent( SDL_Event * event );
+int replay_nextEvent( SDL_Event * event );
+void replay_levelChanged( int level );
 
 /* game state functions */
 int game_init( void );
 void game_cleanup( void );
 int game_setState( void );
+void game_printSummary( void );
+
+/* independent games, see game.c. worlds other than the main one are never drawn or heard */
+typedef struct World World;
+typedef void ( *WorldInputFn )( World * world, void * data );	/* called before every tick */
+
+typedef struct WorldStatus
+{
+	int level, lives, score, coins, dead;
+	float x, y;				/* position of the player */
+	unsigned ticks;			/* milliseconds played */
+} WorldStatus;
+
+World * world_create( void );
+void world_destroy( World * world );
+void world_setInput( World * world, WorldInputFn input, void * data );
+void world_handleEvent( World * world, SDL_Event * event );
+void world_update( World * world, float deltaTick );
+int world_stepAll( World ** worlds, int count, float deltaTick, int ticks );
+void world_getStatus( World * world, WorldStatus * status );
+size_t map_setCacheLimit( size_t bytes );	/* memory for pre-rendered map chunks, returns the limit kept */
 
 #endif
@@ -0,0 +1,122 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "main.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+	frame pacing -- frames are started on a grid of deadlines one period apart. the
+	pacer sleeps until shortly before the deadline and spins for the rest, since a
+	sleep can overshoot by a good part of a millisecond. the interval between frames
+	is recorded so the jitter can be reported.
+*/
+
+static const Uint64 PACER_SPIN_TIME	= 1000000;	/* ns left to spin instead of sleeping */
+
+static Uint64 g_period				= 0;		/* ns per frame, 0 when uncapped */
+static Uint64 g_deadline			= 0;		/* start of the next frame */
+static Uint64 g_lastFrame			= 0;		/* start of the last frame */
+
+static PacerStats g_stats;
+static PacerStats g_totalStats;
+
+/************************************************************/
+
+static void resetStats( PacerStats * stats )
+{
+	stats->frames = 0;
+	stats->sum = stats->sumSquares = 0;
+	stats->min = stats->max = 0;
+}
+
+static void addSample( PacerStats * stats, double interval )
+{
+	if ( stats->frames == 0 || interval < stats->min ) stats->min = interval;
+	if ( stats->frames == 0 || interval > stats->max ) stats->max = interval;
+	stats->sum += interval;
+	stats->sumSquares += interval * interval;
+	stats->frames++;
+}
+
+void pacer_init( int fps )
+{
+	g_period = fps > 0 ? 1000000000 / fps : 0;
+	g_lastFrame = g_deadline = time_getNanos();
+	resetStats( &g_stats );
+	resetStats( &g_totalStats );
+}
+
+void pacer_wait( void )
+{
+	Uint64 now = time_getNanos();
+
+	if ( g_period > 0 )
+	{
+		g_deadline += g_period;
+
+		/* more than a frame behind, start a new grid instead of rushing to catch up. a frame
+		   that is late by less is started right away and the grid is kept */
+		if ( now > g_deadline + g_period )
+			g_deadline = now;
+
+		if ( g_deadline > now && g_deadline - now > PACER_SPIN_TIME )
+		{
+			Uint64 sleep = g_deadline - now - PACER_SPIN_TIME;
+			struct timespec ts;
+			ts.tv_sec = sleep / 1000000000;
+			ts.tv_nsec = sleep % 1000000000;
+			nanosleep( &ts, NULL );
+		}
+
+		while ( ( now = time_getNanos() ) < g_deadline )
+			;
+	}
+
+	double interval = ( now - g_lastFrame ) / 1000000.0;
+	addSample( &g_stats, interval );
+	addSample( &g_totalStats, interval );
+	g_lastFrame = now;
+}
+
+/* returns the statistics since the last call and starts new ones */
+PacerStats pacer_takeStats( void )
+{
+	PacerStats stats = g_stats;
+	resetStats( &g_stats );
+	return stats;
+}
+
+PacerStats pacer_getTotalStats( void )
+{
+	return g_totalStats;
+}
+
+double pacer_getMean( PacerStats * stats )
+{
+	return stats->frames > 0 ? stats->sum / stats->frames : 0;
+}
+
+double pacer_getJitter( PacerStats * stats )
+{
+	if ( stats->frames < 2 ) return 0;
+
+	double mean = pacer_getMean( stats );
+	double variance = stats->sumSquares / stats->frames - mean * mean;
+	return variance > 0 ? sqrt( variance ) : 0;
+}
+
+void pacer_printStats( void )
+{
+	PacerStats * stats = &g_totalStats;
+	char target[20] = "uncapped";
+
+	if ( stats->frames == 0 ) return;
+
+	if ( g_period > 0 )
+		sprintf( target, "%.3f ms", g_period / 1000000.0 );
+
+	fprintf( stdout, "Frame pacing: target %s, %ld frames, interval mean %.3f ms, jitter %.3f ms, min %.3f ms, max %.3f ms\n",
+		target, stats->frames, pacer_getMean( stats ), pacer_getJitter( stats ), stats->min, stats->max );
+}
@@ -0,0 +1,157 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "main.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+	asset archive -- all the assets packed into one file by the pack tool. the
+	archive is mapped and the loaders read the entries straight from the mapping.
+	when there is no archive the loose files are opened instead.
+
+	archive format, values are in the byte order of the machine that packed it:
+
+		header:	'M' 'P' 'A' 'K' | u32 version | u32 entry count
+		index:	one entry per asset: char name[PAK_NAME_SIZE] | u32 offset | u32 size
+		data:	the assets, each starting on a PAK_ALIGN byte boundary
+*/
+
+static const char PAK_MAGIC[4]		= { 'M', 'P', 'A', 'K' };
+static const unsigned int PAK_VERSION	= 1;
+
+#define PAK_NAME_SIZE 56
+#define PAK_ALIGN 64
+#define PAK_MAX_STREAMS 16
+
+typedef struct PakHeader
+{
+	char magic[4];
+	unsigned int version;
+	unsigned int count;			/* number of entries */
+} PakHeader;
+
+typedef struct PakEntry
+{
+	char name[PAK_NAME_SIZE];		/* path of the asset, nul-terminated */
+	unsigned int offset;			/* offset of the data from the start of the archive */
+	unsigned int size;				/* size of the data */
+} PakEntry;
+
+static char * g_pak				= NULL;	/* mapped archive */
+static size_t g_pakSize			= 0;
+static PakEntry * g_pakEntries	= NULL;
+static unsigned int g_pakCount	= 0;
+
+/* streams that are read for as long as their asset lives, closed with the archive */
+static SDL_RWops * g_pakStreams[PAK_MAX_STREAMS];
+static int g_pakStreamCount		= 0;
+
+/************************************************************/
+
+int pak_open( char * filename )
+{
+	struct stat st;
+	unsigned int i;
+
+	int fd = open( filename, O_RDONLY );
+	if ( fd == -1 )
+	{
+		fprintf( stdout, "No asset archive \"%s\", using the loose files\n", filename );
+		return 1;
+	}
+
+	if ( fstat( fd, &st ) != 0 || st.st_size < sizeof( PakHeader ) )
+	{
+		fprintf( stderr, "Failed to load asset archive \"%s\": file is too small\n", filename );
+		close( fd );
+		return 1;
+	}
+
+	char * pak = (char *) mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( pak == MAP_FAILED )
+	{
+		fprintf( stderr, "Failed to map \"%s\"\n", filename );
+		return 1;
+	}
+
+	PakHeader * header = (PakHeader *) pak;
+	PakEntry * entries = (PakEntry *) ( pak + sizeof( PakHeader ) );
+
+	if ( memcmp( header->magic, PAK_MAGIC, 4 ) != 0 || header->version != PAK_VERSION ||
+	     header->count > ( st.st_size - sizeof( PakHeader ) ) / sizeof( PakEntry ) )
+	{
+		fprintf( stderr, "Failed to load asset archive \"%s\": not an archive or unsupported version\n", filename );
+		munmap( pak, st.st_size );
+		return 1;
+	}
+
+	for ( i = 0; i < header->count; i++ )
+		if ( entries[i].offset > st.st_size || entries[i].size > st.st_size - entries[i].offset ||
+		     memchr( entries[i].name, '\0', PAK_NAME_SIZE ) == NULL )
+		{
+			fprintf( stderr, "Failed to load asset archive \"%s\": bad entry %u\n", filename, i );
+			munmap( pak, st.st_size );
+			return 1;
+		}
+
+	g_pak = pak;
+	g_pakSize = st.st_size;
+	g_pakEntries = entries;
+	g_pakCount = header->count;
+
+	fprintf( stdout, "Loaded asset archive: %s (%u assets)\n", filename, g_pakCount );
+
+	return 0;
+}
+
+void pak_close( void )
+{
+	int i;
+	for ( i = 0; i < g_pakStreamCount; i++ )
+		SDL_RWclose( g_pakStreams[i] );
+	g_pakStreamCount = 0;
+
+	if ( g_pak != NULL )
+		munmap( g_pak, g_pakSize );
+	g_pak = NULL;
+	g_pakSize = 0;
+	g_pakEntries = NULL;
+	g_pakCount = 0;
+}
+
+/* opens an asset from the archive, or from its loose file when it isn't in one */
+SDL_RWops * pak_openFile( char * filename )
+{
+	unsigned int i;
+	for ( i = 0; i < g_pakCount; i++ )
+		if ( strcmp( g_pakEntries[i].name, filename ) == 0 )
+			return SDL_RWFromConstMem( g_pak + g_pakEntries[i].offset, g_pakEntries[i].size );
+
+	return SDL_RWFromFile( filename, "rb" );
+}
+
+/* like pak_openFile, for readers that don't free the stream themselves. safe to call from any thread */
+SDL_RWops * pak_openStream( char * filename )
+{
+	SDL_RWops * rw = pak_openFile( filename );
+	if ( rw == NULL )
+		return NULL;
+
+	int i = __sync_fetch_and_add( &g_pakStreamCount, 1 );
+	if ( i >= PAK_MAX_STREAMS )
+	{
+		__sync_fetch_and_sub( &g_pakStreamCount, 1 );
+		fprintf( stderr, "Too many asset streams open: %s\n", filename );
+		SDL_RWclose( rw );
+		return NULL;
+	}
+
+	g_pakStreams[i] = rw;
+	return rw;
+}
@@ -0,0 +1,262 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "main.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+/*
+	worker pool -- every worker has a queue of its own and the jobs are dealt out to
+	the queues in turn. a worker runs the newest job of its queue, which is the most
+	likely to still be in its cache, and once its queue is empty it steals the oldest
+	job of another queue, so the workers that drew short jobs help out the others
+	instead of going idle. a job must not touch the video surface, anything that does
+	has to stay on the main thread.
+*/
+
+#define POOL_MAX_WORKERS 64
+#define POOL_QUEUE_SIZE 256
+
+typedef struct Job
+{
+	JobFn fn;			/* function to run */
+	void * data;		/* argument of the function */
+} Job;
+
+typedef struct JobQueue
+{
+	SDL_mutex * lock;
+	Job jobs[POOL_QUEUE_SIZE];
+	int head;			/* oldest job */
+	int tail;			/* next free slot, the queue is empty when it's the head */
+} JobQueue;
+
+static SDL_Thread * g_workers[POOL_MAX_WORKERS];
+static JobQueue g_queues[POOL_MAX_WORKERS];
+static int g_workerCount			= 0;		/* set before the workers start and kept until they've quit */
+static int g_workersStarted		= 0;		/* threads that pool_stop has to wait for */
+static int g_nextQueue			= 0;		/* queue the next job is dealt to */
+
+static SDL_mutex * g_poolLock		= NULL;	/* guards the counts, a queue lock is never held while taking it */
+static SDL_cond * g_poolWork		= NULL;	/* signalled when a job is queued or the pool stops */
+static SDL_cond * g_poolDone		= NULL;	/* signalled when the last job finishes or a submitter waits for room */
+
+static int g_jobsQueued			= 0;		/* jobs in the queues */
+static int g_jobsUnfinished		= 0;		/* queued or running */
+static int g_submitWaiting		= 0;		/* submitters waiting for room in the queues */
+static int g_poolStopping		= 0;
+
+/************************************************************/
+
+/* takes the newest job of a worker's own queue, or else the oldest job of another one */
+static int takeJob( int index, Job * job )
+{
+	JobQueue * queue;
+	int i;
+
+	for ( i = 0; i < g_workerCount; i++ )
+	{
+		queue = &g_queues[ ( index + i ) % g_workerCount ];
+
+		SDL_LockMutex( queue->lock );
+		if ( queue->head != queue->tail )
+		{
+			if ( i == 0 )
+			{
+				queue->tail = ( queue->tail + POOL_QUEUE_SIZE - 1 ) % POOL_QUEUE_SIZE;
+				*job = queue->jobs[ queue->tail ];
+			}
+			else
+			{
+				*job = queue->jobs[ queue->head ];
+				queue->head = ( queue->head + 1 ) % POOL_QUEUE_SIZE;
+			}
+			SDL_UnlockMutex( queue->lock );
+			return 1;
+		}
+		SDL_UnlockMutex( queue->lock );
+	}
+
+	return 0;
+}
+
+static int worker( void * data )
+{
+	int index = (int) (long) data;
+	Job job;
+
+	while ( 1 )
+	{
+		if ( !takeJob( index, &job ) )
+		{
+			/* the queues looked empty, sleep unless a job was queued since */
+			SDL_LockMutex( g_poolLock );
+			while ( g_jobsQueued == 0 && !g_poolStopping )
+				SDL_CondWait( g_poolWork, g_poolLock );
+			if ( g_jobsQueued == 0 )
+			{
+				SDL_UnlockMutex( g_poolLock );
+				break;
+			}
+			SDL_UnlockMutex( g_poolLock );
+			continue;
+		}
+
+		SDL_LockMutex( g_poolLock );
+		g_jobsQueued--;
+		SDL_UnlockMutex( g_poolLock );
+
+		job.fn( job.data, index );
+
+		SDL_LockMutex( g_poolLock );
+		if ( --g_jobsUnfinished == 0 || g_submitWaiting > 0 )
+			SDL_CondBroadcast( g_poolDone );
+		SDL_UnlockMutex( g_poolLock );
+	}
+
+	return 0;
+}
+
+int pool_start( int workers )
+{
+	int i;
+
+	if ( workers > POOL_MAX_WORKERS )
+		workers = POOL_MAX_WORKERS;
+
+	/* the jobs use the SIMD kernels, which pick their level the first time they're asked */
+	simd_getLevel();
+
+	if ( ( g_poolLock = SDL_CreateMutex() ) == NULL ||
+	     ( g_poolWork = SDL_CreateCond() ) == NULL ||
+	     ( g_poolDone = SDL_CreateCond() ) == NULL )
+	{
+		fprintf( stderr, "Failed to create the worker pool: %s\n", SDL_GetError() );
+		pool_stop();
+		return 1;
+	}
+
+	for ( i = 0; i < workers; i++ )
+	{
+		g_queues[i].head = g_queues[i].tail = 0;
+		if ( ( g_queues[i].lock = SDL_CreateMutex() ) == NULL )
+		{
+			fprintf( stderr, "Failed to create the worker pool: %s\n", SDL_GetError() );
+			pool_stop();
+			return 1;
+		}
+	}
+
+	/* the queues are all made and counted before any worker can steal from them */
+	g_poolStopping = 0;
+	g_nextQueue = 0;
+	g_workerCount = workers;
+	for ( g_workersStarted = 0; g_workersStarted < workers; g_workersStarted++ )
+		if ( ( g_workers[ g_workersStarted ] = SDL_CreateThread( worker, (void *) (long) g_workersStarted ) ) == NULL )
+		{
+			fprintf( stderr, "Failed to start a worker: %s\n", SDL_GetError() );
+			pool_stop();
+			return 1;
+		}
+
+	return 0;
+}
+
+void pool_stop( void )
+{
+	int i;
+
+	if ( g_poolLock != NULL && g_poolWork != NULL )
+	{
+		SDL_LockMutex( g_poolLock );
+		g_poolStopping = 1;
+		SDL_CondBroadcast( g_poolWork );
+		SDL_UnlockMutex( g_poolLock );
+	}
+
+	/* the workers finish the queued jobs before they quit */
+	for ( i = 0; i < g_workersStarted; i++ )
+		SDL_WaitThread( g_workers[i], NULL );
+	g_workersStarted = 0;
+	g_workerCount = 0;
+
+	for ( i = 0; i < POOL_MAX_WORKERS; i++ )
+		if ( g_queues[i].lock != NULL )
+		{
+			SDL_DestroyMutex( g_queues[i].lock );
+			g_queues[i].lock = NULL;
+		}
+
+	if ( g_poolDone != NULL ) SDL_DestroyCond( g_poolDone );
+	if ( g_poolWork != NULL ) SDL_DestroyCond( g_poolWork );
+	if ( g_poolLock != NULL ) SDL_DestroyMutex( g_poolLock );
+	g_poolDone = g_poolWork = NULL;
+	g_poolLock = NULL;
+}
+
+int pool_getWorkerCount( void )
+{
+	return g_workerCount;
+}
+
+/* number of processors online, at least 1 */
+int pool_getCoreCount( void )
+{
+	long cores = sysconf( _SC_NPROCESSORS_ONLN );
+	return cores > 0 ? (int) cores : 1;
+}
+
+void pool_submit( JobFn fn, void * data )
+{
+	int i;
+
+	/* without workers the job is run right away */
+	if ( g_workerCount == 0 )
+	{
+		fn( data, 0 );
+		return;
+	}
+
+	SDL_LockMutex( g_poolLock );
+
+	/* deal the job to the next queue with room, waiting for some when they're all full */
+	while ( 1 )
+	{
+		for ( i = 0; i < g_workerCount; i++ )
+		{
+			JobQueue * queue = &g_queues[ g_nextQueue ];
+			g_nextQueue = ( g_nextQueue + 1 ) % g_workerCount;
+
+			SDL_LockMutex( queue->lock );
+			if ( ( queue->tail + 1 ) % POOL_QUEUE_SIZE != queue->head )
+			{
+				queue->jobs[ queue->tail ].fn = fn;
+				queue->jobs[ queue->tail ].data = data;
+				queue->tail = ( queue->tail + 1 ) % POOL_QUEUE_SIZE;
+				SDL_UnlockMutex( queue->lock );
+
+				g_jobsQueued++;
+				g_jobsUnfinished++;
+				SDL_CondSignal( g_poolWork );
+				SDL_UnlockMutex( g_poolLock );
+				return;
+			}
+			SDL_UnlockMutex( queue->lock );
+		}
+
+		g_submitWaiting++;
+		SDL_CondWait( g_poolDone, g_poolLock );
+		g_submitWaiting--;
+	}
+}
+
+void pool_wait( void )
+{
+	if ( g_workerCount == 0 )
+		return;
+
+	SDL_LockMutex( g_poolLock );
+	while ( g_jobsUnfinished > 0 )
+		SDL_CondWait( g_poolDone, g_poolLock );
+	SDL_UnlockMutex( g_poolLock );
+}
@@ -0,0 +1,221 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "main.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+	frame profiler -- the time spent in each phase is added up over a frame and the
+	frames are kept in a ring buffer. the overlay shows a graph of the recent frames,
+	stacked by phase, and the median and 99th percentile of every phase. F3 toggles
+	the overlay and F4 writes the ring buffer to a CSV file. only the thread that runs
+	the frames is recorded, the ticks of a simulation thread are left out.
+*/
+
+#define PROF_FRAMES 512
+#define PROF_GRAPH_WIDTH 256
+#define PROF_GRAPH_HEIGHT 64
+
+static const double PROF_GRAPH_SCALE		= 2.0;		/* pixels per millisecond */
+static const char * PROF_DUMP_FILE		= "profile.csv";
+
+static const char * PROF_PHASE_NAMES[PROF_PHASES] =
+{
+	"events", "update", "draw", "present", "platforms", "player", "enemies", "coins", "hud"
+};
+
+/* colors of the top level phases in the graph */
+static const Uint8 PROF_PHASE_COLORS[PROF_TOP_PHASES][3] =
+{
+	{ 0xFF, 0xFF, 0x00 }, { 0x00, 0xFF, 0x00 }, { 0x00, 0x80, 0xFF }, { 0xFF, 0x40, 0x40 }
+};
+
+static float g_samples[PROF_FRAMES][PROF_PHASES];	/* milliseconds per phase of each frame */
+static int g_next					= 0;			/* slot of the next frame */
+static int g_count					= 0;			/* number of frames recorded */
+
+static float g_current[PROF_PHASES];				/* frame being recorded */
+static Uint64 g_started[PROF_PHASES];
+static Uint32 g_thread				= 0;			/* thread that is recorded */
+
+static int g_overlay				= 0;
+static SDL_Surface * g_graph			= NULL;
+static GlyphAtlas * g_atlas			= NULL;
+
+/************************************************************/
+
+void prof_init( void )
+{
+	g_thread = SDL_ThreadID();
+}
+
+void prof_begin( ProfPhase phase )
+{
+	if ( SDL_ThreadID() == g_thread )
+		g_started[ phase ] = time_getNanos();
+}
+
+void prof_end( ProfPhase phase )
+{
+	if ( SDL_ThreadID() == g_thread )
+		g_current[ phase ] += ( time_getNanos() - g_started[ phase ] ) / 1000000.0;
+}
+
+void prof_endFrame( void )
+{
+	memcpy( g_samples[ g_next ], g_current, sizeof( g_current ) );
+	memset( g_current, 0, sizeof( g_current ) );
+
+	g_next = ( g_next + 1 ) % PROF_FRAMES;
+	if ( g_count < PROF_FRAMES )
+		g_count++;
+}
+
+/* returns the slot of a frame, 0 being the oldest one recorded */
+static int frameSlot( int frame )
+{
+	return ( g_next - g_count + frame + PROF_FRAMES ) % PROF_FRAMES;
+}
+
+/************************************************************/
+
+int prof_dump( char * filename )
+{
+	int i, p;
+
+	FILE * fp = fopen( filename, "w" );
+	if ( fp == NULL )
+	{
+		fprintf( stderr, "Failed to open \"%s\" for writing\n", filename );
+		return 1;
+	}
+
+	fprintf( fp, "frame" );
+	for ( p = 0; p < PROF_PHASES; p++ )
+		fprintf( fp, ",%s_ms", PROF_PHASE_NAMES[p] );
+	fprintf( fp, "\n" );
+
+	for ( i = 0; i < g_count; i++ )
+	{
+		fprintf( fp, "%d", i );
+		for ( p = 0; p < PROF_PHASES; p++ )
+			fprintf( fp, ",%.4f", g_samples[ frameSlot( i ) ][p] );
+		fprintf( fp, "\n" );
+	}
+
+	fclose( fp );
+	fprintf( stdout, "Wrote %d frames to %s\n", g_count, filename );
+
+	return 0;
+}
+
+/* handles the profiler keys, returns 1 if the key was one of them */
+int prof_handleKey( SDLKey key )
+{
+	switch ( key )
+	{
+		case SDLK_F3:	g_overlay = !g_overlay; return 1;
+		case SDLK_F4:	prof_dump( (char *) PROF_DUMP_FILE ); return 1;
+		default:		return 0;
+	}
+}
+
+/************************************************************/
+
+static int compareFloats( const void * a, const void * b )
+{
+	float x = *(const float *) a, y = *(const float *) b;
+	return x < y ? -1 : x > y;
+}
+
+/* finds the median and the 99th percentile of a phase */
+static void percentiles( ProfPhase phase, float * p50, float * p99 )
+{
+	float sorted[PROF_FRAMES];
+	int i;
+
+	for ( i = 0; i < g_count; i++ )
+		sorted[i] = g_samples[ frameSlot( i ) ][ phase ];
+	qsort( sorted, g_count, sizeof( float ), compareFloats );
+
+	*p50 = sorted[ ( g_count - 1 ) / 2 ];
+	*p99 = sorted[ ( g_count - 1 ) * 99 / 100 ];
+}
+
+/* draws the recent frames into the graph surface, one column per frame */
+static void drawGraph( void )
+{
+	SDL_Rect bar;
+	int i, p, frames = g_count < PROF_GRAPH_WIDTH ? g_count : PROF_GRAPH_WIDTH;
+
+	SDL_FillRect( g_graph, NULL, SDL_MapRGB( g_graph->format, 0x00, 0x00, 0x00 ) );
+
+	/* a line at the length of a 60 Hz frame */
+	bar = rect( 0, PROF_GRAPH_HEIGHT - (int) ( 1000.0 / 60 * PROF_GRAPH_SCALE ), PROF_GRAPH_WIDTH, 1 );
+	SDL_FillRect( g_graph, &bar, SDL_MapRGB( g_graph->format, 0x80, 0x80, 0x80 ) );
+
+	for ( i = 0; i < frames; i++ )
+	{
+		float * sample = g_samples[ frameSlot( g_count - frames + i ) ];
+		int top = PROF_GRAPH_HEIGHT;
+
+		for ( p = 0; p < PROF_TOP_PHASES && top > 0; p++ )
+		{
+			int height = (int) ( sample[p] * PROF_GRAPH_SCALE + 0.5 );
+			if ( height > top ) height = top;
+			if ( height == 0 ) continue;
+
+			top -= height;
+			bar = rect( PROF_GRAPH_WIDTH - frames + i, top, 1, height );
+			SDL_FillRect( g_graph, &bar, SDL_MapRGB( g_graph->format,
+				PROF_PHASE_COLORS[p][0], PROF_PHASE_COLORS[p][1], PROF_PHASE_COLORS[p][2] ) );
+		}
+	}
+}
+
+void prof_setAtlas( GlyphAtlas * atlas )
+{
+	g_atlas = atlas;
+}
+
+void prof_drawOverlay( void )
+{
+	char str[48];
+	float p50, p99;
+	int p, x = 5, y = 30;
+
+	if ( !g_overlay || g_count == 0 || g_atlas == NULL ) return;
+
+	if ( g_graph == NULL )
+	{
+		SDL_Surface * graph = SDL_CreateRGBSurface( SDL_SWSURFACE, PROF_GRAPH_WIDTH, PROF_GRAPH_HEIGHT, 32, 0, 0, 0, 0 );
+		if ( graph == NULL || ( g_graph = SDL_DisplayFormat( graph ) ) == NULL )
+		{
+			fprintf( stderr, "Failed to create the profiler graph: %s\n", SDL_GetError() );
+			g_overlay = 0;
+		}
+		SDL_FreeSurface( graph );
+		if ( g_graph == NULL ) return;
+	}
+
+	drawGraph();
+	drawImage( g_graph, NULL, x, y );
+	y += PROF_GRAPH_HEIGHT + 4;
+
+	drawRect( rect( x, y, PROF_GRAPH_WIDTH, ( PROF_PHASES + 1 ) * g_atlas->height ), 0, 0, 0, 255 );
+	drawText( g_atlas, "phase      p50 ms  p99 ms", x, y );
+
+	for ( p = 0; p < PROF_PHASES; p++ )
+	{
+		percentiles( p, &p50, &p99 );
+		sprintf( str, "%-9s %7.3f %7.3f", PROF_PHASE_NAMES[p], p50, p99 );
+		drawText( g_atlas, str, x, y + ( p + 1 ) * g_atlas->height );
+	}
+}
+
+void prof_cleanup( void )
+{
+	FreeSurface( g_graph );
+}
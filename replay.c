@@ -0,0 +1,257 @@
+#include "main.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+	replay file format, all values are little-endian:
+
+		header:	'M' 'R' 'P' 'L' | u16 version | u16 tick rate
+		record:	u32 tick | u8 type | u8 unused | u16 value
+
+	key records hold the SDLKey that went down or up before the tick was simulated,
+	so together they describe the key state of every tick. level records hold the
+	level that was entered during the tick and are only used to detect a desync.
+	the end record holds the tick the recording was stopped at.
+*/
+
+static const char REPLAY_MAGIC[4]		= { 'M', 'R', 'P', 'L' };
+static const int REPLAY_VERSION		= 1;
+
+#define RECORD_SIZE 8
+
+typedef enum RecordType
+{
+	RECORD_KEYDOWN = 1,
+	RECORD_KEYUP,
+	RECORD_LEVEL,
+	RECORD_END
+} RecordType;
+
+typedef struct Record
+{
+	unsigned tick;			/* tick the record belongs to */
+	RecordType type;		/* type of record */
+	int value;			/* key or level */
+} Record;
+
+static FILE * g_recordFp			= NULL;
+
+static Record * g_records			= NULL;
+static int g_recordCount			= 0;
+static int g_nextKey				= 0;	/* next key record to play */
+static int g_nextLevel				= 0;	/* next level record to check */
+static unsigned g_endTick			= 0;
+static int g_desynced				= 0;
+
+/************************************************************/
+
+static void writeRecord( unsigned tick, RecordType type, int value )
+{
+	unsigned char buf[RECORD_SIZE];
+
+	buf[0] = tick & 0xFF;
+	buf[1] = ( tick >> 8 ) & 0xFF;
+	buf[2] = ( tick >> 16 ) & 0xFF;
+	buf[3] = ( tick >> 24 ) & 0xFF;
+	buf[4] = type;
+	buf[5] = 0;
+	buf[6] = value & 0xFF;
+	buf[7] = ( value >> 8 ) & 0xFF;
+
+	fwrite( buf, 1, RECORD_SIZE, g_recordFp );
+}
+
+static Record readRecord( unsigned char * buf )
+{
+	Record r;
+	r.tick = buf[0] | ( buf[1] << 8 ) | ( buf[2] << 16 ) | ( (unsigned) buf[3] << 24 );
+	r.type = buf[4];
+	r.value = buf[6] | ( buf[7] << 8 );
+	return r;
+}
+
+/************************************************************/
+
+int replay_startRecording( char * filename, int tickRate )
+{
+	unsigned char header[8];
+
+	g_recordFp = fopen( filename, "wb" );
+	if ( g_recordFp == NULL )
+	{
+		fprintf( stderr, "Failed to open replay \"%s\" for writing\n", filename );
+		return 1;
+	}
+
+	memcpy( header, REPLAY_MAGIC, 4 );
+	header[4] = REPLAY_VERSION & 0xFF;
+	header[5] = ( REPLAY_VERSION >> 8 ) & 0xFF;
+	header[6] = tickRate & 0xFF;
+	header[7] = ( tickRate >> 8 ) & 0xFF;
+	fwrite( header, 1, sizeof( header ), g_recordFp );
+
+	fprintf( stdout, "Recording replay: %s\n", filename );
+
+	return 0;
+}
+
+int replay_startPlayback( char * filename, int * tickRate )
+{
+	unsigned char header[8], buf[RECORD_SIZE];
+	int size = 64;
+
+	FILE * fp = fopen( filename, "rb" );
+	if ( fp == NULL )
+	{
+		fprintf( stderr, "Failed to open replay \"%s\": file not found\n", filename );
+		return 1;
+	}
+
+	if ( fread( header, 1, sizeof( header ), fp ) != sizeof( header ) || memcmp( header, REPLAY_MAGIC, 4 ) != 0 )
+	{
+		fprintf( stderr, "Failed to load replay \"%s\": not a replay file\n", filename );
+		fclose( fp );
+		return 1;
+	}
+
+	if ( ( header[4] | ( header[5] << 8 ) ) != REPLAY_VERSION )
+	{
+		fprintf( stderr, "Failed to load replay \"%s\": unsupported version %d\n", filename, header[4] | ( header[5] << 8 ) );
+		fclose( fp );
+		return 1;
+	}
+
+	/* the header's rate replaces the one given on the command line, so it's checked the same way */
+	int rate = header[6] | ( header[7] << 8 );
+	if ( rate == 0 )
+	{
+		fprintf( stderr, "Failed to load replay \"%s\": invalid tick rate 0\n", filename );
+		fclose( fp );
+		return 1;
+	}
+
+	g_records = (Record *) malloc( sizeof( Record ) * size );
+	g_recordCount = 0;
+	g_endTick = 0;
+	if ( g_records == NULL )
+		goto out_of_memory;
+
+	while ( fread( buf, 1, RECORD_SIZE, fp ) == RECORD_SIZE )
+	{
+		if ( g_recordCount == size )
+		{
+			Record * records = (Record *) realloc( g_records, sizeof( Record ) * size * 2 );
+			if ( records == NULL )
+				goto out_of_memory;
+			g_records = records;
+			size *= 2;
+		}
+
+		g_records[ g_recordCount ] = readRecord( buf );
+
+		if ( g_records[ g_recordCount ].tick > g_endTick )
+			g_endTick = g_records[ g_recordCount ].tick;
+		if ( g_records[ g_recordCount++ ].type == RECORD_END )
+			break;
+	}
+
+	fclose( fp );
+
+	*tickRate = rate;
+	g_nextKey = g_nextLevel = 0;
+	g_desynced = 0;
+
+	fprintf( stdout, "Playing replay: %s (%u ticks at %d Hz)\n", filename, g_endTick, *tickRate );
+
+	return 0;
+
+	out_of_memory:
+
+		fprintf( stderr, "Failed to load replay \"%s\": out of memory\n", filename );
+		free( g_records );
+		g_records = NULL;
+		g_recordCount = 0;
+		fclose( fp );
+
+	return 1;
+}
+
+void replay_stop( void )
+{
+	if ( g_recordFp != NULL )
+	{
+		writeRecord( sim_getStep(), RECORD_END, 0 );
+		fclose( g_recordFp );
+		g_recordFp = NULL;
+	}
+
+	free( g_records );
+	g_records = NULL;
+	g_recordCount = 0;
+}
+
+int replay_isPlaying( void )
+{
+	return g_records != NULL;
+}
+
+int replay_isFinished( void )
+{
+	return g_records != NULL && sim_getStep() >= g_endTick;
+}
+
+/************************************************************/
+
+void replay_recordEvent( SDL_Event * event )
+{
+	if ( g_recordFp == NULL ) return;
+
+	if ( event->type == SDL_KEYDOWN )
+		writeRecord( sim_getStep(), RECORD_KEYDOWN, event->key.keysym.sym );
+	else if ( event->type == SDL_KEYUP )
+		writeRecord( sim_getStep(), RECORD_KEYUP, event->key.keysym.sym );
+}
+
+int replay_nextEvent( SDL_Event * event )
+{
+	if ( g_records == NULL ) return 0;
+
+	/* skip over the records that aren't input */
+	while ( g_nextKey < g_recordCount &&
+		   g_records[ g_nextKey ].type != RECORD_KEYDOWN && g_records[ g_nextKey ].type != RECORD_KEYUP )
+		g_nextKey++;
+
+	if ( g_nextKey == g_recordCount || g_records[ g_nextKey ].tick > sim_getStep() )
+		return 0;
+
+	memset( event, 0, sizeof( SDL_Event ) );
+	event->type = g_records[ g_nextKey ].type == RECORD_KEYDOWN ? SDL_KEYDOWN : SDL_KEYUP;
+	event->key.type = event->type;
+	event->key.keysym.sym = (SDLKey) g_records[ g_nextKey ].value;
+
+	g_nextKey++;
+
+	return 1;
+}
+
+void replay_levelChanged( int level )
+{
+	if ( g_recordFp != NULL )
+		writeRecord( sim_getStep(), RECORD_LEVEL, level );
+
+	if ( g_records == NULL || g_desynced ) return;
+
+	while ( g_nextLevel < g_recordCount && g_records[ g_nextLevel ].type != RECORD_LEVEL )
+		g_nextLevel++;
+
+	if ( g_nextLevel == g_recordCount ||
+		g_records[ g_nextLevel ].tick != sim_getStep() || g_records[ g_nextLevel ].value != level )
+	{
+		fprintf( stderr, "Replay desynced at tick %u: entered level %d\n", sim_getStep(), level );
+		g_desynced = 1;
+		return;
+	}
+
+	g_nextLevel++;
+}
@@ -0,0 +1,163 @@
+#include "main.h"
+
+#include <stdio.h>
+
+/*
+	vectorized kernels -- each kernel has a scalar version and, on x86, SSE2 and AVX2
+	versions. the best one the CPU supports is picked the first time a kernel is used.
+*/
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+static int g_simdLevel = -1;
+
+static const char * SIMD_LEVEL_NAMES[] = { "scalar", "sse2", "avx2" };
+
+/* highest level the CPU supports */
+static int simd_getSupported( void )
+{
+	int level = SIMD_SCALAR;
+#ifdef SIMD_X86
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports( "avx2" ) )
+		level = SIMD_AVX2;
+	else if ( __builtin_cpu_supports( "sse2" ) )
+		level = SIMD_SSE2;
+#endif
+	return level;
+}
+
+/* the level is worked out on the main thread by pool_start, before the workers use the kernels */
+int simd_getLevel( void )
+{
+	if ( g_simdLevel == -1 )
+		g_simdLevel = simd_getSupported();
+	return g_simdLevel;
+}
+
+int simd_setLevel( int level )
+{
+	/* never go above what the CPU supports */
+	int supported = simd_getSupported();
+
+	g_simdLevel = level > supported ? supported : level < SIMD_SCALAR ? SIMD_SCALAR : level;
+	return g_simdLevel;
+}
+
+const char * simd_getLevelName( int level )
+{
+	return SIMD_LEVEL_NAMES[ level ];
+}
+
+/************************************************************/
+
+static void addScaled_scalar( float * dst, const float * src, float scale, int count )
+{
+	int i;
+	for ( i = 0; i < count; i++ )
+		dst[i] += src[i] * scale;
+}
+
+#ifdef SIMD_X86
+
+__attribute__(( target( "sse2" ) ))
+static void addScaled_sse2( float * dst, const float * src, float scale, int count )
+{
+	__m128 s = _mm_set1_ps( scale );
+	int i;
+	for ( i = 0; i + 4 <= count; i += 4 )
+		_mm_storeu_ps( dst + i, _mm_add_ps( _mm_loadu_ps( dst + i ), _mm_mul_ps( _mm_loadu_ps( src + i ), s ) ) );
+	addScaled_scalar( dst + i, src + i, scale, count - i );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void addScaled_avx2( float * dst, const float * src, float scale, int count )
+{
+	__m256 s = _mm256_set1_ps( scale );
+	int i;
+	for ( i = 0; i + 8 <= count; i += 8 )
+		_mm256_storeu_ps( dst + i, _mm256_add_ps( _mm256_loadu_ps( dst + i ), _mm256_mul_ps( _mm256_loadu_ps( src + i ), s ) ) );
+	addScaled_scalar( dst + i, src + i, scale, count - i );
+}
+
+#endif
+
+void simd_addScaled( float * dst, const float * src, float scale, int count )
+{
+	switch ( simd_getLevel() )
+	{
+#ifdef SIMD_X86
+		case SIMD_AVX2:	addScaled_avx2( dst, src, scale, count ); break;
+		case SIMD_SSE2:	addScaled_sse2( dst, src, scale, count ); break;
+#endif
+		default:		addScaled_scalar( dst, src, scale, count ); break;
+	}
+}
+
+/************************************************************/
+
+/*
+	masked blit -- copies the pixels of a 32bpp image whose mask is all ones and leaves
+	the others alone. pitches are in pixels and the mask has the pitch of the image.
+*/
+
+static void blitMasked_scalar( Uint32 * dst, int dstPitch, const Uint32 * src, const Uint32 * mask, int srcPitch, int width, int height )
+{
+	int x, y;
+	for ( y = 0; y < height; y++, dst += dstPitch, src += srcPitch, mask += srcPitch )
+		for ( x = 0; x < width; x++ )
+			dst[x] = ( src[x] & mask[x] ) | ( dst[x] & ~mask[x] );
+}
+
+#ifdef SIMD_X86
+
+__attribute__(( target( "sse2" ) ))
+static void blitMasked_sse2( Uint32 * dst, int dstPitch, const Uint32 * src, const Uint32 * mask, int srcPitch, int width, int height )
+{
+	int x, y;
+	for ( y = 0; y < height; y++, dst += dstPitch, src += srcPitch, mask += srcPitch )
+	{
+		for ( x = 0; x + 4 <= width; x += 4 )
+		{
+			__m128i m = _mm_loadu_si128( (const __m128i *) ( mask + x ) );
+			__m128i s = _mm_loadu_si128( (const __m128i *) ( src + x ) );
+			__m128i d = _mm_loadu_si128( (const __m128i *) ( dst + x ) );
+			_mm_storeu_si128( (__m128i *) ( dst + x ), _mm_or_si128( _mm_and_si128( m, s ), _mm_andnot_si128( m, d ) ) );
+		}
+		blitMasked_scalar( dst + x, dstPitch, src + x, mask + x, srcPitch, width - x, 1 );
+	}
+}
+
+__attribute__(( target( "avx2" ) ))
+static void blitMasked_avx2( Uint32 * dst, int dstPitch, const Uint32 * src, const Uint32 * mask, int srcPitch, int width, int height )
+{
+	int x, y;
+	for ( y = 0; y < height; y++, dst += dstPitch, src += srcPitch, mask += srcPitch )
+	{
+		for ( x = 0; x + 8 <= width; x += 8 )
+		{
+			__m256i m = _mm256_loadu_si256( (const __m256i *) ( mask + x ) );
+			__m256i s = _mm256_loadu_si256( (const __m256i *) ( src + x ) );
+			__m256i d = _mm256_loadu_si256( (const __m256i *) ( dst + x ) );
+			_mm256_storeu_si256( (__m256i *) ( dst + x ), _mm256_blendv_epi8( d, s, m ) );
+		}
+		blitMasked_sse2( dst + x, dstPitch, src + x, mask + x, srcPitch, width - x, 1 );
+	}
+}
+
+#endif
+
+void simd_blitMasked( Uint32 * dst, int dstPitch, const Uint32 * src, const Uint32 * mask, int srcPitch, int width, int height )
+{
+	switch ( simd_getLevel() )
+	{
+#ifdef SIMD_X86
+		case SIMD_AVX2:	blitMasked_avx2( dst, dstPitch, src, mask, srcPitch, width, height ); break;
+		case SIMD_SSE2:	blitMasked_sse2( dst, dstPitch, src, mask, srcPitch, width, height ); break;
+#endif
+		default:		blitMasked_scalar( dst, dstPitch, src, mask, srcPitch, width, height ); break;
+	}
+}
@@ -0,0 +1,130 @@
+/*
+	level compiler -- turns a text level into the compiled format that the game streams
+	its chunks from, see map_openCompiled. the game is built into this file so the level
+	is read exactly like the game reads it, and main.c is built with NO_MAIN.
+
+	usage: levelc <level> [output]
+	the output defaults to the level's name with ".bin" appended.
+*/
+
+#include "../game.c"
+
+/* writes a section and pads the file up to the next one */
+static void writeSection( FILE * fp, const void * data, size_t size, unsigned int end )
+{
+	static const char ZEROES[LEVEL_ALIGN] = { 0 };
+
+	fwrite( data, 1, size, fp );
+	fwrite( ZEROES, 1, end - ftell( fp ), fp );
+}
+
+static int compileLevel( char * filename, char * output )
+{
+	Arena arena;
+	LevelHeader header;
+	int i, x, y;
+
+	if ( arena_init( &arena, MAP_ARENA_SIZE ) != 0 )
+		return 1;
+
+	Map * map = map_openText( filename, &arena );
+	if ( map == NULL )
+	{
+		arena_free( &arena );
+		return 1;
+	}
+
+	memset( &header, 0, sizeof( header ) );
+	memcpy( header.magic, LEVEL_MAGIC, 4 );
+	header.version = LEVEL_VERSION;
+	header.width = map->width;
+	header.height = map->height;
+	header.startPos = map->startPos;
+	header.endPos = map->endPos;
+	header.coinCount = map->cc.count;
+	header.coins = level_align( sizeof( header ) );
+	header.chunks = level_align( header.coins + map_getBitsetSize( map ) );
+	header.chunkSize = level_getChunkSize( map->height );
+	header.size = header.chunks + map->chunkCount * header.chunkSize;
+
+	FILE * fp = fopen( output, "wb" );
+	if ( fp == NULL )
+	{
+		fprintf( stderr, "Failed to open \"%s\" for writing\n", output );
+		map_close( map );
+		arena_free( &arena );
+		return 1;
+	}
+
+	/* the header is written again once the chunks have been counted */
+	writeSection( fp, &header, sizeof( header ), header.coins );
+	writeSection( fp, map->cc.tiles, map_getBitsetSize( map ), header.chunks );
+
+	for ( i = 0; i < map->chunkCount; i++ )
+	{
+		Chunk * chunk = &map->chunks[ i % MAP_CHUNK_SLOTS ];
+		unsigned int platforms = 0, enemies = 0;
+
+		if ( map_loadChunk( map, i ) != 0 )
+			break;
+
+		for ( y = 0; y < map->height; y++ )
+			for ( x = 0; x < MAP_CHUNK_WIDTH; x++ )
+				switch ( chunk->tiles[ y * MAP_CHUNK_WIDTH + x ] )
+				{
+					case 'H':
+					case 'V':	platforms++; break;
+					case 'G':	enemies++; break;
+				}
+		if ( platforms > header.maxPlatforms )
+			header.maxPlatforms = platforms;
+		if ( enemies > header.maxEnemies )
+			header.maxEnemies = enemies;
+
+		writeSection( fp, chunk->tiles, MAP_CHUNK_WIDTH * map->height, header.chunks + i * header.chunkSize + level_align( MAP_CHUNK_WIDTH * map->height ) );
+		writeSection( fp, chunk->solid, sizeof( unsigned int ) * map->height, header.chunks + ( i + 1 ) * header.chunkSize );
+	}
+
+	rewind( fp );
+	fwrite( &header, sizeof( header ), 1, fp );
+
+	int failed = ferror( fp ) || i < map->chunkCount;
+	if ( fclose( fp ) != 0 || failed )
+	{
+		fprintf( stderr, "Failed to write \"%s\"\n", output );
+		map_close( map );
+		arena_free( &arena );
+		return 1;
+	}
+
+	fprintf( stdout, "Compiled %s: %u coins, %d chunks of at most %u platforms and %u enemies, %u bytes\n",
+		output, header.coinCount, map->chunkCount, header.maxPlatforms, header.maxEnemies, header.size );
+
+	map_close( map );
+	arena_free( &arena );
+	return 0;
+}
+
+int main( int argc, char ** argv )
+{
+	char output[FILENAME_MAX];
+
+	if ( argc < 2 || argc > 3 )
+	{
+		fprintf( stderr, "Usage: %s <level> [output]\n", argv[0] );
+		return 1;
+	}
+
+	if ( strlen( argc == 3 ? argv[2] : argv[1] ) + 5 > sizeof( output ) )
+	{
+		fprintf( stderr, "File name is too long\n" );
+		return 1;
+	}
+
+	if ( argc == 3 )
+		strcpy( output, argv[2] );
+	else
+		sprintf( output, "%s.bin", argv[1] );
+
+	return compileLevel( argv[1], output );
+}
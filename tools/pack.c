@@ -0,0 +1,122 @@
+/*
+	asset packer -- packs the asset files into one archive, see pak.c for the format.
+	the entries are named by the paths given, which are the paths the game loads.
+
+	usage: pack <archive> <files...>
+*/
+
+#include "../pak.c"
+
+static unsigned int alignOffset( unsigned int offset )
+{
+	return ( offset + PAK_ALIGN - 1 ) & ~( PAK_ALIGN - 1 );
+}
+
+/* copies a file into the archive, returns its size or -1 */
+static long copyFile( FILE * out, char * filename )
+{
+	char buf[4096];
+	size_t read;
+	long size = 0;
+
+	FILE * fp = fopen( filename, "rb" );
+	if ( fp == NULL )
+	{
+		fprintf( stderr, "Failed to open \"%s\"\n", filename );
+		return -1;
+	}
+
+	while ( ( read = fread( buf, 1, sizeof( buf ), fp ) ) > 0 )
+	{
+		fwrite( buf, 1, read, out );
+		size += read;
+	}
+
+	if ( ferror( fp ) )
+	{
+		fprintf( stderr, "Failed to read \"%s\"\n", filename );
+		size = -1;
+	}
+
+	fclose( fp );
+	return size;
+}
+
+int main( int argc, char ** argv )
+{
+	static const char ZEROES[PAK_ALIGN] = { 0 };
+	PakHeader header;
+	int i, count = argc - 2;
+
+	if ( argc < 3 )
+	{
+		fprintf( stderr, "Usage: %s <archive> <files...>\n", argv[0] );
+		return 1;
+	}
+
+	PakEntry * entries = (PakEntry *) calloc( count, sizeof( PakEntry ) );
+	if ( entries == NULL )
+		return 1;
+
+	for ( i = 0; i < count; i++ )
+		if ( strlen( argv[ i + 2 ] ) >= PAK_NAME_SIZE )
+		{
+			fprintf( stderr, "Name is too long: %s\n", argv[ i + 2 ] );
+			free( entries );
+			return 1;
+		}
+		else
+			strcpy( entries[i].name, argv[ i + 2 ] );
+
+	FILE * out = fopen( argv[1], "wb" );
+	if ( out == NULL )
+	{
+		fprintf( stderr, "Failed to open \"%s\" for writing\n", argv[1] );
+		free( entries );
+		return 1;
+	}
+
+	/* the index is written again once the offsets and sizes are known */
+	memcpy( header.magic, PAK_MAGIC, 4 );
+	header.version = PAK_VERSION;
+	header.count = count;
+	fwrite( &header, sizeof( header ), 1, out );
+	fwrite( entries, sizeof( PakEntry ), count, out );
+
+	for ( i = 0; i < count; i++ )
+	{
+		unsigned int offset = alignOffset( ftell( out ) );
+		fwrite( ZEROES, 1, offset - ftell( out ), out );
+
+		long size = copyFile( out, entries[i].name );
+		if ( size < 0 )
+		{
+			fclose( out );
+			remove( argv[1] );
+			free( entries );
+			return 1;
+		}
+
+		entries[i].offset = offset;
+		entries[i].size = size;
+	}
+
+	fseek( out, sizeof( header ), SEEK_SET );
+	fwrite( entries, sizeof( PakEntry ), count, out );
+
+	int failed = ferror( out );
+	if ( fclose( out ) != 0 || failed )
+	{
+		fprintf( stderr, "Failed to write \"%s\"\n", argv[1] );
+		remove( argv[1] );
+		free( entries );
+		return 1;
+	}
+
+	for ( i = 0; i < count; i++ )
+		fprintf( stdout, "  %-24s %8u bytes at %u\n", entries[i].name, entries[i].size, entries[i].offset );
+	fprintf( stdout, "Packed %d assets into %s\n", count, argv[1] );
+
+	free( entries );
+	return 0;
+}